@@ -0,0 +1,594 @@
+/*
+ * Allocator micro-benchmark suite.
+ *
+ * Drives buddy_alloc and buddy_free directly, without the simulator's parser
+ * and output in the way, through a set of allocation patterns:
+ *
+ *   uniform   sizes uniform in [1, max], random slot churn
+ *   powerlaw  Pareto distributed sizes, random slot churn
+ *   lifo      fill a batch, free it newest first
+ *   fifo      fill a batch, free it oldest first
+ *   random    fill a batch, free it in random order
+ *   churn     hold the live set near a fixed fraction of the arena
+ *
+ * Every pattern is run against the buddy allocator and, for comparison,
+ * glibc malloc and jemalloc (when libjemalloc can be loaded), with the same
+ * seed so that each allocator sees the same request sequence.  For each run
+ * we report throughput, per-operation latency percentiles and
+ * fragmentation.  Throughput only counts time spent inside the allocator.
+ */
+
+#include <dlfcn.h>
+#include <getopt.h>
+#include <malloc.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "buddy.h"
+#include "cycles.h"
+
+#define PAGE_SIZE ((size_t)1 << MIN_ORDER)
+
+/* Live blocks tracked by the slot patterns */
+#define MAX_SLOTS 4096
+
+/* Fragmentation is sampled every this many operations */
+#define FRAG_INTERVAL 256
+
+/**
+ * An allocator under test
+ */
+typedef struct allocator_t {
+	const char *name;
+	void *(*alloc)(size_t size);
+	void (*free)(void *ptr);
+	size_t (*usable)(void *ptr, size_t size);	///< Bytes actually reserved
+	void (*reset)();				///< Start from an empty heap, may be NULL
+	int is_buddy;
+} allocator_t;
+
+/**
+ * Benchmark parameters shared by all patterns
+ */
+typedef struct params_t {
+	long ops;		///< Operations per run
+	unsigned seed;		///< Seed for the request sequence
+	size_t max_size;	///< Largest request in bytes
+	int slots;		///< Live blocks for the slot and batch patterns
+	double occupancy;	///< Target live fraction of the arena for churn
+} params_t;
+
+/**
+ * Results of one pattern on one allocator
+ */
+typedef struct result_t {
+	long ops;
+	long failed;
+	uint64_t *lat;		///< Cycles per operation
+	double cycles;		///< Sum of lat
+	double ext_frag;	///< Mean external fragmentation over the samples
+	long frag_samples;
+	double requested;	///< Bytes asked for over all allocations
+	double reserved;	///< Bytes the allocator set aside for them
+} result_t;
+
+/**
+ * State handed to the pattern drivers
+ */
+typedef struct run_t {
+	const allocator_t *a;
+	const params_t *p;
+	result_t *r;
+	uint64_t rng;
+	void **ptr;
+	size_t *size;
+	size_t live;		///< Bytes currently requested and not freed
+	int nlive;		///< Occupied slots
+} run_t;
+
+
+/**************************************************************************
+ * Allocators
+ **************************************************************************/
+
+/**
+ * @brief Size of the buddy block backing a request.
+ */
+static size_t buddy_usable(void *ptr, size_t size)
+{
+	size_t block = PAGE_SIZE;
+	(void)ptr;
+	while (block < size)
+		block <<= 1;
+	return block;
+}
+
+static size_t libc_usable(void *ptr, size_t size)
+{
+	(void)size;
+	return malloc_usable_size(ptr);
+}
+
+static void *(*je_malloc)(size_t);
+static void (*je_free)(void *);
+static size_t (*je_usable_size)(void *);
+
+static size_t je_usable(void *ptr, size_t size)
+{
+	(void)size;
+	return je_usable_size ? je_usable_size(ptr) : size;
+}
+
+/**
+ * @brief Bind jemalloc's entry points from the given library, if present.
+ *
+ * Symbols are looked up through the handle, so this works even though the
+ * process itself keeps using glibc malloc.
+ */
+static int load_jemalloc(const char *path)
+{
+	void *h = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (h == NULL)
+		return 0;
+
+	je_malloc = (void *(*)(size_t))dlsym(h, "malloc");
+	je_free = (void (*)(void *))dlsym(h, "free");
+	je_usable_size = (size_t (*)(void *))dlsym(h, "malloc_usable_size");
+
+	return je_malloc != NULL && je_free != NULL;
+}
+
+static void je_free_wrap(void *ptr)
+{
+	je_free(ptr);
+}
+
+static void *je_malloc_wrap(size_t size)
+{
+	return je_malloc(size);
+}
+
+static allocator_t allocators[] = {
+	{ "buddy", buddy_alloc, buddy_free, buddy_usable, buddy_init, 1 },
+	{ "malloc", malloc, free, libc_usable, NULL, 0 },
+	{ "jemalloc", je_malloc_wrap, je_free_wrap, je_usable, NULL, 0 },
+};
+#define NUM_ALLOCATORS ((int)(sizeof(allocators) / sizeof(allocators[0])))
+
+
+/**************************************************************************
+ * Helpers
+ **************************************************************************/
+
+/**
+ * @brief xorshift64*, reproducible across libcs unlike rand().
+ */
+static uint64_t next_rand(uint64_t *s)
+{
+	*s ^= *s >> 12;
+	*s ^= *s << 25;
+	*s ^= *s >> 27;
+	return *s * 2685821657736338717ull;
+}
+
+/**
+ * @brief Uniform double in [0, 1).
+ */
+static double next_unit(uint64_t *s)
+{
+	return (next_rand(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static size_t uniform_size(run_t *run)
+{
+	return 1 + next_rand(&run->rng) % run->p->max_size;
+}
+
+/**
+ * @brief Pareto distributed size with alpha 1.2 and a 64 byte minimum, so
+ * 		most requests are small and a few are near max_size.
+ */
+static size_t powerlaw_size(run_t *run)
+{
+	double u = 1.0 - next_unit(&run->rng);
+	double size = 64.0 * pow(u, -1.0 / 1.2);
+
+	if (size > run->p->max_size)
+		size = run->p->max_size;
+	return (size_t)size;
+}
+
+/**
+ * @brief External fragmentation of the buddy heap: the share of free memory
+ * 		that is not in the largest free block.
+ */
+static double buddy_ext_frag()
+{
+	double free_bytes = 0;
+	double largest = 0;
+	int o;
+
+	for (o = MIN_ORDER; o <= MAX_ORDER; o++) {
+		int n = buddy_free_count(o);
+		free_bytes += (double)n * ((size_t)1 << o);
+		if (n)
+			largest = (size_t)1 << o;
+	}
+	return free_bytes > 0 ? 1.0 - largest / free_bytes : 0.0;
+}
+
+/**
+ * @brief Time one allocation into a slot.
+ */
+static void do_alloc(run_t *run, int slot, size_t size)
+{
+	uint64_t t0 = read_cycles();
+	void *ptr = run->a->alloc(size);
+	uint64_t dt = read_cycles() - t0;
+
+	run->r->lat[run->r->ops++] = dt;
+	run->r->cycles += dt;
+
+	if (ptr == NULL) {
+		run->r->failed++;
+		return;
+	}
+
+	run->ptr[slot] = ptr;
+	run->size[slot] = size;
+	run->live += size;
+	run->nlive++;
+	run->r->requested += size;
+	run->r->reserved += run->a->usable(ptr, size);
+}
+
+/**
+ * @brief Time the free of a slot.
+ */
+static void do_free(run_t *run, int slot)
+{
+	uint64_t t0 = read_cycles();
+	run->a->free(run->ptr[slot]);
+	uint64_t dt = read_cycles() - t0;
+
+	run->r->lat[run->r->ops++] = dt;
+	run->r->cycles += dt;
+	run->live -= run->size[slot];
+	run->nlive--;
+	run->ptr[slot] = NULL;
+}
+
+/**
+ * @brief Sample fragmentation every FRAG_INTERVAL operations.
+ */
+static void maybe_sample(run_t *run)
+{
+	if (!run->a->is_buddy || run->r->ops % FRAG_INTERVAL != 0)
+		return;
+	run->r->ext_frag += buddy_ext_frag();
+	run->r->frag_samples++;
+}
+
+
+/**************************************************************************
+ * Patterns
+ **************************************************************************/
+
+/**
+ * @brief Pick a random slot, free it if occupied, fill it otherwise.
+ */
+static void run_slots(run_t *run, size_t (*size_fn)(run_t *))
+{
+	while (run->r->ops < run->p->ops) {
+		int s = next_rand(&run->rng) % run->p->slots;
+
+		if (run->ptr[s] != NULL)
+			do_free(run, s);
+		else
+			do_alloc(run, s, size_fn(run));
+		maybe_sample(run);
+	}
+}
+
+static void run_uniform(run_t *run)
+{
+	run_slots(run, uniform_size);
+}
+
+static void run_powerlaw(run_t *run)
+{
+	run_slots(run, powerlaw_size);
+}
+
+/**
+ * @brief Fill every slot, then free them in the order given by mode:
+ * 		0 newest first, 1 oldest first, 2 random.
+ */
+static void run_batches(run_t *run, int mode)
+{
+	int n = run->p->slots;
+	int *order = malloc(n * sizeof(int));
+	int i;
+
+	while (run->r->ops < run->p->ops) {
+		for (i = 0; i < n && run->r->ops < run->p->ops; i++) {
+			do_alloc(run, i, uniform_size(run));
+			maybe_sample(run);
+		}
+
+		for (i = 0; i < n; i++)
+			order[i] = mode == 0 ? n - 1 - i : i;
+		if (mode == 2) {
+			for (i = n - 1; i > 0; i--) {
+				int j = next_rand(&run->rng) % (i + 1);
+				int t = order[i];
+				order[i] = order[j];
+				order[j] = t;
+			}
+		}
+
+		for (i = 0; i < n && run->r->ops < run->p->ops; i++) {
+			if (run->ptr[order[i]] != NULL) {
+				do_free(run, order[i]);
+				maybe_sample(run);
+			}
+		}
+	}
+
+	free(order);
+}
+
+static void run_lifo(run_t *run)
+{
+	run_batches(run, 0);
+}
+
+static void run_fifo(run_t *run)
+{
+	run_batches(run, 1);
+}
+
+static void run_random(run_t *run)
+{
+	run_batches(run, 2);
+}
+
+/**
+ * @brief Allocate while the live set is under the occupancy target and free
+ * 		a random live block while it is over.  Use enough slots (-k) to
+ * 		reach the target, or the run degrades to slot churn.
+ */
+static void run_churn(run_t *run)
+{
+	size_t target = (size_t)(run->p->occupancy * ((size_t)1 << MAX_ORDER));
+
+	while (run->r->ops < run->p->ops) {
+		int s = next_rand(&run->rng) % run->p->slots;
+
+		if (run->nlive == 0 || (run->live < target && run->nlive < run->p->slots)) {
+			// Find a free slot near s
+			while (run->ptr[s] != NULL)
+				s = (s + 1) % run->p->slots;
+			do_alloc(run, s, uniform_size(run));
+		}
+		else {
+			while (run->ptr[s] == NULL)
+				s = (s + 1) % run->p->slots;
+			do_free(run, s);
+		}
+		maybe_sample(run);
+	}
+}
+
+typedef struct pattern_t {
+	const char *name;
+	void (*run)(run_t *run);
+} pattern_t;
+
+static const pattern_t patterns[] = {
+	{ "uniform", run_uniform },
+	{ "powerlaw", run_powerlaw },
+	{ "lifo", run_lifo },
+	{ "fifo", run_fifo },
+	{ "random", run_random },
+	{ "churn", run_churn },
+};
+#define NUM_PATTERNS ((int)(sizeof(patterns) / sizeof(patterns[0])))
+
+
+/**************************************************************************
+ * Reporting
+ **************************************************************************/
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Cycles per nanosecond of read_cycles(), measured over 20ms.
+ */
+static double calibrate()
+{
+	struct timespec a, b;
+	uint64_t c0, c1;
+	double ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &a);
+	c0 = read_cycles();
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &b);
+		ns = (b.tv_sec - a.tv_sec) * 1e9 + (b.tv_nsec - a.tv_nsec);
+	} while (ns < 20e6);
+	c1 = read_cycles();
+
+	return (c1 - c0) / ns;
+}
+
+static void print_header()
+{
+	printf("%-9s %-9s %9s %12s %8s %8s %8s %9s %9s %8s\n",
+	       "pattern", "allocator", "ops", "ops/s", "p50ns", "p99ns",
+	       "p999ns", "ext.frag", "int.frag", "failed");
+}
+
+static void print_result(const pattern_t *pat, const allocator_t *a,
+			 result_t *r, double cycles_per_ns)
+{
+	qsort(r->lat, r->ops, sizeof(uint64_t), cmp_u64);
+
+	double secs = r->cycles / cycles_per_ns / 1e9;
+	uint64_t p50 = r->lat[(long)(r->ops * 0.50)];
+	uint64_t p99 = r->lat[(long)(r->ops * 0.99)];
+	uint64_t p999 = r->lat[(long)(r->ops * 0.999)];
+
+	printf("%-9s %-9s %9ld %12.0f %8.0f %8.0f %8.0f ",
+	       pat->name, a->name, r->ops, secs > 0 ? r->ops / secs : 0.0,
+	       p50 / cycles_per_ns, p99 / cycles_per_ns, p999 / cycles_per_ns);
+
+	if (r->frag_samples)
+		printf("%8.1f%% ", 100.0 * r->ext_frag / r->frag_samples);
+	else
+		printf("%9s ", "-");
+
+	printf("%8.1f%% %8ld\n",
+	       r->reserved > 0 ? 100.0 * (1.0 - r->requested / r->reserved) : 0.0,
+	       r->failed);
+}
+
+
+/**
+ * Output program manual
+ *
+ * @param prog_name Name of the program passed in as a command line argument.
+ * @param out File stream to write to.
+ */
+static void print_usage(char* prog_name, FILE* out)
+{
+	int i;
+
+	fprintf(out, "Usage:\n");
+	fprintf(out, "  %s [-n ops] [-s seed] [-m max_size] [-k slots] [-o occupancy]\n", prog_name);
+	fprintf(out, "     [-p pattern] [-a allocator] [-j libjemalloc.so]\n");
+	fprintf(out, "     -n - Operations per run (default 1000000)\n");
+	fprintf(out, "     -s - Seed of the request sequence (default 1)\n");
+	fprintf(out, "     -m - Largest request in bytes (default 16384)\n");
+	fprintf(out, "     -k - Live blocks for the slot and batch patterns (default 32)\n");
+	fprintf(out, "     -o - Live fraction of the arena for churn (default 0.5)\n");
+	fprintf(out, "     -p - Run only this pattern:");
+	for (i = 0; i < NUM_PATTERNS; i++)
+		fprintf(out, " %s", patterns[i].name);
+	fprintf(out, "\n     -a - Run only this allocator: buddy malloc jemalloc\n");
+	fprintf(out, "     -j - jemalloc library to load (default libjemalloc.so.2)\n");
+}
+
+int main(int argc, char** argv)
+{
+	params_t p = { 1000000, 1, 16384, 32, 0.5 };
+	const char *only_pattern = NULL;
+	const char *only_alloc = NULL;
+	const char *je_path = "libjemalloc.so.2";
+	int have_je;
+	int opt, i, j;
+
+	while ((opt = getopt(argc, argv, "n:s:m:k:o:p:a:j:")) != -1) {
+		switch (opt) {
+		case 'n':
+			p.ops = atol(optarg);
+			break;
+		case 's':
+			p.seed = (unsigned)atoi(optarg);
+			break;
+		case 'm':
+			p.max_size = (size_t)atol(optarg);
+			break;
+		case 'k':
+			p.slots = atoi(optarg);
+			break;
+		case 'o':
+			p.occupancy = atof(optarg);
+			break;
+		case 'p':
+			only_pattern = optarg;
+			break;
+		case 'a':
+			only_alloc = optarg;
+			break;
+		case 'j':
+			je_path = optarg;
+			break;
+		default:
+			print_usage(argv[0], stderr);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (p.ops <= 0 || p.max_size == 0 || p.slots <= 0 || p.slots > MAX_SLOTS ||
+	    p.occupancy <= 0 || p.occupancy >= 1) {
+		print_usage(argv[0], stderr);
+		return EXIT_FAILURE;
+	}
+
+	have_je = load_jemalloc(je_path);
+	if (!have_je && only_alloc == NULL)
+		fprintf(stderr, "Note: %s not found, skipping the jemalloc baseline\n", je_path);
+
+	double cycles_per_ns = calibrate();
+
+	result_t r;
+	r.lat = malloc(p.ops * sizeof(uint64_t));
+	void **ptr = malloc(MAX_SLOTS * sizeof(void *));
+	size_t *size = malloc(MAX_SLOTS * sizeof(size_t));
+	if (r.lat == NULL || ptr == NULL || size == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	print_header();
+
+	for (i = 0; i < NUM_PATTERNS; i++) {
+		if (only_pattern && strcmp(only_pattern, patterns[i].name) != 0)
+			continue;
+
+		for (j = 0; j < NUM_ALLOCATORS; j++) {
+			const allocator_t *a = &allocators[j];
+			int k;
+
+			if (only_alloc && strcmp(only_alloc, a->name) != 0)
+				continue;
+			if (a->alloc == je_malloc_wrap && !have_je)
+				continue;
+
+			uint64_t *lat = r.lat;
+			memset(&r, 0, sizeof(r));
+			r.lat = lat;
+			memset(ptr, 0, MAX_SLOTS * sizeof(void *));
+
+			run_t run = { a, &p, &r, p.seed * 0x9e3779b97f4a7c15ull + 1, ptr, size, 0, 0 };
+
+			if (a->reset)
+				a->reset();
+
+			patterns[i].run(&run);
+
+			print_result(&patterns[i], a, &r, cycles_per_ns);
+
+			// Leave nothing behind for the next run
+			for (k = 0; k < p.slots; k++)
+				if (ptr[k] != NULL)
+					a->free(ptr[k]);
+		}
+	}
+
+	free(r.lat);
+	free(ptr);
+	free(size);
+
+	return EXIT_SUCCESS;
+}
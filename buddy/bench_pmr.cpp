@@ -0,0 +1,276 @@
+/*
+ * Container benchmark for the buddy memory resource.
+ *
+ * Runs container-heavy workloads with their storage on a BuddyResource and,
+ * for comparison, on std::pmr::new_delete_resource():
+ *
+ *   vector     push_back into a growing vector of ints
+ *   map        insert random keys into a map, look them up, erase half
+ *   unordered  the same on an unordered_map
+ *   string     build a vector of strings of random lengths, then sort it
+ *   list       push at both ends of a list, then pop half of it
+ *
+ * Each round builds the containers from empty and tears them down again,
+ * so allocation and deallocation are both in the time.  Both resources see
+ * the same keys and lengths, and each run prints a checksum of what the
+ * containers held, which must match between them.  The whole working set
+ * of a round fits the buddy heap.
+ */
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <map>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "buddy_pmr.hpp"
+
+/**
+ * Benchmark parameters shared by all workloads
+ */
+struct params_t {
+	long rounds;		///< Rounds per run
+	uint64_t seed;		///< Seed for the keys and lengths
+	int scale;		///< Elements per round, in hundreds
+};
+
+/**
+ * A workload: runs one round on a resource and returns a checksum of the
+ * containers' contents, adding the container operations it did to ops
+ */
+struct workload_t {
+	const char *name;
+	uint64_t (*round)(std::pmr::memory_resource *r, const params_t &p, uint64_t &rng, long &ops);
+};
+
+
+/**************************************************************************
+ * Helpers
+ **************************************************************************/
+
+/**
+ * @brief xorshift64*, as in bench.c.
+ */
+static uint64_t next_rand(uint64_t &s)
+{
+	s ^= s >> 12;
+	s ^= s << 25;
+	s ^= s >> 27;
+	return s * 2685821657736338717ull;
+}
+
+
+/**************************************************************************
+ * Workloads
+ **************************************************************************/
+
+static uint64_t round_vector(std::pmr::memory_resource *r, const params_t &p, uint64_t &rng, long &ops)
+{
+	std::pmr::vector<uint32_t> v(r);
+	const int n = p.scale * 200;
+	uint64_t sum = 0;
+
+	for (int i = 0; i < n; i++)
+		v.push_back(static_cast<uint32_t>(next_rand(rng)));
+	for (uint32_t x : v)
+		sum += x;
+	ops += n;
+	return sum;
+}
+
+static uint64_t round_map(std::pmr::memory_resource *r, const params_t &p, uint64_t &rng, long &ops)
+{
+	std::pmr::map<uint32_t, uint32_t> m(r);
+	const int n = p.scale * 50;
+	uint64_t sum = 0;
+
+	for (int i = 0; i < n; i++)
+		m.emplace(static_cast<uint32_t>(next_rand(rng)), i);
+	for (auto it = m.begin(); it != m.end();) {
+		sum += it->first ^ it->second;
+		it = it->first & 1 ? m.erase(it) : std::next(it);
+	}
+	ops += n + m.size();
+	return sum + m.size();
+}
+
+static uint64_t round_unordered(std::pmr::memory_resource *r, const params_t &p, uint64_t &rng, long &ops)
+{
+	std::pmr::unordered_map<uint32_t, uint32_t> m(r);
+	std::vector<uint32_t> keys(p.scale * 50);
+	uint64_t sum = 0;
+
+	for (uint32_t &k : keys) {
+		k = static_cast<uint32_t>(next_rand(rng));
+		m.emplace(k, k >> 3);
+	}
+	for (uint32_t k : keys)
+		sum += m.count(k) ? m[k] : 0;
+	for (std::size_t i = 0; i < keys.size(); i += 2)
+		m.erase(keys[i]);
+	ops += 2 * keys.size() + keys.size() / 2;
+	return sum + m.size();
+}
+
+static uint64_t round_string(std::pmr::memory_resource *r, const params_t &p, uint64_t &rng, long &ops)
+{
+	std::pmr::vector<std::pmr::string> v(r);
+	const int n = p.scale * 15;
+	uint64_t sum = 0;
+
+	for (int i = 0; i < n; i++) {
+		uint64_t x = next_rand(rng);
+		v.emplace_back(16 + x % 240, static_cast<char>('a' + (x >> 32) % 26));
+	}
+	std::sort(v.begin(), v.end());
+	for (const auto &s : v)
+		sum = sum * 31 + s.size() + s[0];
+	ops += n;
+	return sum;
+}
+
+static uint64_t round_list(std::pmr::memory_resource *r, const params_t &p, uint64_t &rng, long &ops)
+{
+	std::pmr::list<uint32_t> l(r);
+	const int n = p.scale * 100;
+	uint64_t sum = 0;
+
+	for (int i = 0; i < n; i++) {
+		uint32_t x = static_cast<uint32_t>(next_rand(rng));
+		if (x & 1)
+			l.push_back(x);
+		else
+			l.push_front(x);
+	}
+	for (int i = 0; i < n / 2; i++) {
+		sum += l.front();
+		l.pop_front();
+	}
+	ops += n + n / 2;
+	return sum + l.size();
+}
+
+static const workload_t workloads[] = {
+	{ "vector", round_vector },
+	{ "map", round_map },
+	{ "unordered", round_unordered },
+	{ "string", round_string },
+	{ "list", round_list },
+};
+#define NUM_WORKLOADS ((int)(sizeof(workloads) / sizeof(workloads[0])))
+
+
+/**************************************************************************
+ * Running
+ **************************************************************************/
+
+/**
+ * @brief Run a workload for p.rounds rounds and print one result line.
+ * @return 0, or -1 if the resource ran out of memory
+ */
+static int run(const workload_t &w, const char *name, std::pmr::memory_resource *r, const params_t &p)
+{
+	uint64_t rng = p.seed, check = 0;
+	long ops = 0;
+
+	auto t0 = std::chrono::steady_clock::now();
+	try {
+		for (long i = 0; i < p.rounds; i++)
+			check = check * 1000003 + w.round(r, p, rng, ops);
+	} catch (const std::bad_alloc &) {
+		printf("%-9s %-10s out of memory, try a smaller -k\n", w.name, name);
+		return -1;
+	}
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	printf("%-9s %-10s %8ld %12.0f %12.0f  %016llx\n",
+	       w.name, name, p.rounds, secs * 1e9 / p.rounds, ops / secs,
+	       (unsigned long long)check);
+	return 0;
+}
+
+/**
+ * Output program manual
+ *
+ * @param prog_name Name of the program passed in as a command line argument.
+ * @param out File stream to write to.
+ */
+static void print_usage(char *prog_name, FILE *out)
+{
+	int i;
+
+	fprintf(out, "Usage:\n");
+	fprintf(out, "  %s [-n rounds] [-s seed] [-k scale] [-w workload] [-r resource]\n", prog_name);
+	fprintf(out, "     -n - Rounds per run (default 200)\n");
+	fprintf(out, "     -s - Seed of the keys and lengths (default 1)\n");
+	fprintf(out, "     -k - Elements per round, in hundreds (default 10)\n");
+	fprintf(out, "     -w - Run only this workload:");
+	for (i = 0; i < NUM_WORKLOADS; i++)
+		fprintf(out, " %s", workloads[i].name);
+	fprintf(out, "\n     -r - Run only this resource: buddy new_delete\n");
+}
+
+int main(int argc, char **argv)
+{
+	params_t p = { 200, 1, 10 };
+	const char *only_workload = NULL;
+	const char *only_resource = NULL;
+	int opt, i, status = 0;
+
+	while ((opt = getopt(argc, argv, "n:s:k:w:r:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			p.rounds = atol(optarg);
+			break;
+		case 's':
+			p.seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'k':
+			p.scale = atoi(optarg);
+			break;
+		case 'w':
+			only_workload = optarg;
+			break;
+		case 'r':
+			only_resource = optarg;
+			break;
+		case 'h':
+			print_usage(argv[0], stdout);
+			return EXIT_SUCCESS;
+		default:
+			print_usage(argv[0], stderr);
+			return EXIT_FAILURE;
+		}
+	}
+	if (p.rounds <= 0 || p.scale <= 0 || p.seed == 0) {
+		print_usage(argv[0], stderr);
+		return EXIT_FAILURE;
+	}
+
+	printf("%-9s %-10s %8s %12s %12s  %s\n",
+	       "workload", "resource", "rounds", "ns/round", "ops/s", "check");
+
+	for (i = 0; i < NUM_WORKLOADS; i++) {
+		const workload_t &w = workloads[i];
+
+		if (only_workload && strcmp(only_workload, w.name))
+			continue;
+		if (!only_resource || !strcmp(only_resource, "buddy")) {
+			buddy_init();
+			BuddyResource r;
+			status |= run(w, "buddy", &r, p);
+		}
+		if (!only_resource || !strcmp(only_resource, "new_delete"))
+			status |= run(w, "new_delete", std::pmr::new_delete_resource(), p);
+	}
+	return status ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -8,34 +8,65 @@
  **************************************************************************/
 #define USE_DEBUG 0
 
+/* Record per-call cycle counts into the buddy_latency.h histograms */
+#ifndef USE_LATENCY
+#  define USE_LATENCY 0
+#endif
+
+/*
+ * Heap checking: validate the whole structure after every call, poison freed
+ * memory and verify the poison on reallocation, and reject bad frees with a
+ * diagnostic.  Nothing of it is compiled in otherwise.
+ */
+#ifndef USE_CHECK
+#  define USE_CHECK 0
+#endif
+
+/*
+ * Serve the buddy.h API from the BuddyAllocator in buddy_cxx.cpp instead of
+ * the default arena below; the arenas are compiled in either way, as the
+ * NUMA and malloc layers are built on them.
+ */
+#ifndef BUDDY_CXX_HEAP
+#  define BUDDY_CXX_HEAP 0
+#endif
+
 /**************************************************************************
  * Included Files
  **************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <assert.h>
 
 #include "buddy.h"
-#include "list.h"
+#include "buddy_arena.h"
+#include "buddy_latency.h"
+#include "buddy_numa.h"
+#include "buddy_trace.h"
+#include "cycles.h"
 
 /**************************************************************************
  * Public Definitions
  **************************************************************************/
-#define MIN_ORDER 12	// Represents the power of 2 of the minimum block size in bytes
-#define MAX_ORDER 20	// Represents the power of 2 of the maximum block size in bytes
+#define PAGE_SIZE BUDDY_PAGE_SIZE	// Represents the size of a page in bytes
 
-#define PAGE_SIZE (1<<MIN_ORDER)	// Represents the size of a page in bytes
+/* page index to address in arena a */
+#define PAGE_TO_ADDR(a, page_idx) (void *)((page_idx*PAGE_SIZE) + (a)->memory)
 
-/* page index to address */
-#define PAGE_TO_ADDR(page_idx) (void *)((page_idx*PAGE_SIZE) + g_memory)
+/* address to page index in arena a */
+#define ADDR_TO_PAGE(a, addr) ((size_t)((char *)(addr) - (a)->memory) / PAGE_SIZE)
 
-/* address to page index */
-#define ADDR_TO_PAGE(addr) ((unsigned long)((void *)addr - (void *)g_memory) / PAGE_SIZE)
+/* first page of the block after the one starting at page p in arena a */
+#define NEXT_HEAD(a, p) ((p) + ((size_t)1 << ((a)->pages[p].order - MIN_ORDER)))
 
-/* find buddy address */
-#define BUDDY_ADDR(addr, o) (void *)((((unsigned long)addr - (unsigned long)g_memory) ^ (1<<o)) \
-									 + (unsigned long)g_memory)
+/* find buddy address in arena a */
+#define BUDDY_ADDR(a, addr, o) (void *)((a)->memory + \
+				(((size_t)((char *)(addr) - (a)->memory)) ^ ((size_t)1 << (o))))
 
 #if USE_DEBUG == 1
 #  define PDEBUG(fmt, ...) \
@@ -47,62 +78,38 @@
 #  define IFDEBUG(x)
 #endif
 
+#if USE_LATENCY
+#  define LAT_BEGIN() uint64_t lat_start = read_cycles()
+#  define LAT_END(op, order) buddy_latency_record((op), (order), read_cycles() - lat_start)
+#else
+#  define LAT_BEGIN()
+#  define LAT_END(op, order) ((void)(order))
+#endif
 
-/**************************************************************************
- * Public Types
- **************************************************************************/
-
-
-/**
- * @type block_t
- *
- * @details The block type represents one or more pages in a compact format.
- * It makes use of the Linux kernel linked list, so it includes the list_head
- * type as a handle into that system.
- */
-typedef struct {
-
-
-	/* Usage notes
-	 *
-	 * Every list member has a member called list_head, because the Linux
-	 * kernel uses a circular linked list scheme.
-	 *
-	 * list_head is used internally, and we need only to include it in our
-	 * struct and initialize it to be able to use a linked list.
-	 *
-	 * When an individual element is initialized, its next and previous
-	 * pointer are set to itself.
-	 */
-	struct list_head list;
-
-	// The address where this page begins
-	char* address;
-
-	// The power of 2 representing the number of bytes in this block
-	int order;
-
-	// Is this page free
-	int isFree;
-
-} block_t;
+#if USE_CHECK
+#  define PCHECK(fmt, ...) fprintf(stderr, "buddy: " fmt "\n", ##__VA_ARGS__)
+#  define FREE_POISON 0xdb	// Fill for free memory, checked on allocation
+#  define ALLOC_FILL 0xa5	// Fill for fresh allocations
+#endif
 
 
 /**************************************************************************
  * Global Variables
  **************************************************************************/
 
-/* free lists, store structs representing pages in blocks of various orders */
-struct list_head free_area[MAX_ORDER+1];
-
+#if !BUDDY_CXX_HEAP
 /*
- * memory area, no real use beyond the macros and initialization
- * In fact, this is only still here because it was included code...
+ * memory area of the default arena, which serves the buddy.h API.  Mapped
+ * by the first buddy_init rather than static, as arenas of 2 GiB and more
+ * do not fit the default code model; the mapping is page aligned, so blocks
+ * are aligned to their size up to a page, and pages are only backed once
+ * they are touched.
  */
-char g_memory[1<<MAX_ORDER];
+char *g_memory;
 
-/* block structures */
-block_t g_pages[(1<<MAX_ORDER)/PAGE_SIZE];
+/* free lists and block structures of the default arena, mapped alongside */
+static buddy_arena_t *default_arena;
+#endif
 
 
 /**************************************************************************
@@ -117,10 +124,10 @@ block_t g_pages[(1<<MAX_ORDER)/PAGE_SIZE];
 // Helpers
 
 // Merge two blocks, and move to the next highest order.
-void merge(block_t *block, block_t *buddy);
+void merge(buddy_arena_t *a, block_t *block, block_t *buddy);
 
 // Print a graph of the current allocations
-void print_free_area();
+void print_free_area(buddy_arena_t *a);
 
 // Count and report number of block_t elements in the free_area of the
 // specified order
@@ -131,18 +138,26 @@ void print_block(block_t * pg);
 
 // Locate and return a pointer to the first free block in a given order for
 // free_area, or NULL if no such block exists.
-block_t* find_free_block(int order);
+block_t* find_free_block(buddy_arena_t *a, int order);
 
 // Print block information for all free_area members, along with counts of
 // each size block among all possible sizes
-void buddy_dump_verbose();
+void buddy_dump_verbose(buddy_arena_t *a);
 
 // Print counts of each size block among all possible sizes in free_area
 void buddy_dump();
 
 // Returns a pointer to the buddy block with the given address if it exists in
 // the free_area, or NULL otherwise
-block_t* find_block(char* addr, int order);
+block_t* find_block(buddy_arena_t *a, char* addr, int order);
+
+#if USE_CHECK
+// Run buddy_check and abort if the heap is inconsistent
+void check_or_die(buddy_arena_t *a, const char *where);
+
+// Returns 1 if the block at addr is filled with FREE_POISON
+int poison_intact(char *addr, int order);
+#endif
 
 
 /**************************************************************************
@@ -151,10 +166,18 @@ block_t* find_block(char* addr, int order);
 
 
 /**
- * @brief Initialize a list of all possible addresses for the given MAX_ORDER,
- *		and set up a list element for the first address.
+ * @brief Set up the free lists with the whole arena as one free block.
+ *
+ * Only the first page's descriptor is written.  A descriptor is read only
+ * while its block is on a list, and a split writes every field of the right
+ * half's descriptor before listing it, so the others are set up the first
+ * time a split reaches them.  This keeps init O(orders) and leaves the
+ * descriptor array untouched, and unfaulted, until the heap is used.
+ *
+ * @param a arena to set up
+ * @param memory BUDDY_ARENA_BYTES for the arena to hand out
  */
-void buddy_init()
+void buddy_arena_init(buddy_arena_t *a, char *memory)
 {
 
 #if USE_DEBUG
@@ -162,37 +185,31 @@ void buddy_init()
 #endif
 
 	int i;
-	int n_pages = (1<<MAX_ORDER) / PAGE_SIZE;
+
+	a->memory = memory;
+	a->relocate = NULL;
+	a->relocate_arg = NULL;
 
 	/* initialize freelist */
 	for (i = MIN_ORDER; i <= MAX_ORDER; i++) {
-		INIT_LIST_HEAD(&free_area[i]);
+		INIT_LIST_HEAD(&a->free_area[i]);
+		a->free_count[i] = 0;
 	}
 
-	for (i = 0; i < n_pages; i++) {
-
-		//block_t *temp = (block_t*)malloc(sizeof(block_t));
-
-		//g_pages[i] = *temp;
-
-		// Initialize this as a linked list element
-		INIT_LIST_HEAD(&g_pages[i].list);
+	// The first page heads the one block, the rest wait for splits
+	INIT_LIST_HEAD(&a->pages[0].list);
+	a->pages[0].isFree = 1;
+	a->pages[0].order = MAX_ORDER;
+	a->pages[0].flags = 0;
+	a->pages[0].address = (char*)PAGE_TO_ADDR(a, 0);
 
-		// All start as free
-		g_pages[i].isFree = 1;
-
-		// All start in highest order
-		g_pages[i].order = MAX_ORDER;
-
-		// Address is increments of page size from start
-		//(g_pages[i].address) = (g_memory + (i*PAGE_SIZE));
-		g_pages[i].address = (char*)PAGE_TO_ADDR(i);
-	
-	}
-	
 	/* add the entire memory as a single free block */
-	list_add(&g_pages[0].list, &free_area[MAX_ORDER]);
-		
+	list_add(&a->pages[0].list, &a->free_area[MAX_ORDER]);
+	a->free_count[MAX_ORDER] = 1;
+
+#if USE_CHECK
+	memset(a->memory, FREE_POISON, BUDDY_ARENA_BYTES);
+#endif
 
 #if USE_DEBUG
 	printf("Done\n");
@@ -215,7 +232,7 @@ void buddy_init()
  * @param size size in bytes
  * @return memory block address
  */
-void *buddy_alloc(int size)
+void *buddy_arena_alloc(buddy_arena_t *a, size_t size)
 {
 
 	/*
@@ -235,13 +252,19 @@ void *buddy_alloc(int size)
 
 
 
+	LAT_BEGIN();
+
 #if USE_DEBUG
-	printf("Attempting to allocate for size %d...\n", size);
+	printf("Attempting to allocate for size %zu...\n", size);
 #endif
 
 	// Check that size is valid
-	if(size > (1 << MAX_ORDER) || size < 0){
-		//printf("[ INVALID SIZE ERROR : MAX SIZE IS %d BYTES ]\n", (1 << MAX_ORDER));
+	if(size > BUDDY_ARENA_BYTES){
+		//printf("[ INVALID SIZE ERROR : MAX SIZE IS %zu BYTES ]\n", BUDDY_ARENA_BYTES);
+
+		// Traced as one order too large, which replays as a failure too
+		BUDDY_TRACE(TRACE_ALLOC_FAIL, MAX_ORDER + 1, 0);
+		LAT_END(LAT_ALLOC, LAT_ORDER_INVALID);
 		return NULL;
 	}
 
@@ -257,13 +280,13 @@ void *buddy_alloc(int size)
 	printf("Allocation is not too big...\n");
 #endif
 
-	if(size <= (1 << MIN_ORDER)){
+	if(size <= PAGE_SIZE){
 		target_order = MIN_ORDER;	
 	}
 	else{
 		// While the size we are looking at, divided by two, is larger than
 		// the allocation size...
-		while(size <= (1 <<(target_order-1))){
+		while(size <= ((size_t)1 << (target_order-1))){
 		
 			// Update order for allocation
 			target_order--;
@@ -273,11 +296,13 @@ void *buddy_alloc(int size)
 	//Starting from the target order, find the smallest free_area with
 	//free blocks
 	for(active_order = target_order; active_order <= MAX_ORDER; active_order++){
-		if(NULL != find_free_block(active_order)){
+		if(NULL != find_free_block(a, active_order)){
 			break;
 		}
 		else if(active_order == MAX_ORDER){
 			//printf("[ OUT OF MEMORY ERROR ]\n");
+			BUDDY_TRACE(TRACE_ALLOC_FAIL, target_order, 0);
+			LAT_END(LAT_ALLOC, target_order);
 			return NULL;
 		}
 		else{
@@ -290,22 +315,22 @@ void *buddy_alloc(int size)
 
 
 #if USE_DEBUG
-	printf("Settled on order %d (%d bytes) for size %d...\n", target_order, (1<<target_order), size);
+	printf("Settled on order %d (%zu bytes) for size %zu...\n", target_order, (size_t)1 << target_order, size);
 #endif
 
 	// Make sure that we have free memory to allocate the requested size
-	assert((1 << active_order) >= size);
+	assert(((size_t)1 << active_order) >= size);
 
 #if USE_DEBUG
 	printf("We have enough memory to perform the allocation...\n");
-	printf("The smallest block size with free pages is order %d (%d bytes)\n", active_order, (1 << active_order));
+	printf("The smallest block size with free pages is order %d (%zu bytes)\n", active_order, (size_t)1 << active_order);
 #endif
 
 	// Determine how many splits need to take place
 	num_splits = active_order - target_order;
 
 	// Retrieve the first empty block
-	lefty = find_free_block(active_order);
+	lefty = find_free_block(a, active_order);
 	
 	assert(NULL != lefty);
 	
@@ -315,48 +340,52 @@ void *buddy_alloc(int size)
 		// Since we are already at the target order, simply mark the
 		// first free entry as taken and return its address.
 		lefty->isFree = 0;
+		a->free_count[active_order]--;
 	}
 	else{
 
 #if USE_DEBUG
 		printf("Removing left half from current active list...\n");
-		count_blocks(&free_area[active_order]);
+		count_blocks(&a->free_area[active_order]);
 #endif
 		
 	
 		// Need to remove the left from this order
 		list_del(&lefty->list);
+		a->free_count[active_order]--;
 		
-		//count_blocks(&free_area[active_order]);
+		//count_blocks(&a->free_area[active_order]);
 
 		while(num_splits > 0){
 
 			// Determine the right half side start address from the left half.  Retrieve the
 			// associated page from g_pages. Use the enxt lowest
 			// order since we are breaking this downward
-			char * right_addr = BUDDY_ADDR(lefty->address, (active_order-1));
-			righty = &g_pages[ADDR_TO_PAGE(right_addr)];
+			char * right_addr = BUDDY_ADDR(a, lefty->address, (active_order-1));
+			righty = &a->pages[ADDR_TO_PAGE(a, right_addr)];
 			righty->order = active_order-1;
 			righty->isFree = 1;
 			righty->address = right_addr;
+			righty->flags = 0;
 			
 			
 #if USE_DEBUG
 			printf("Right half at order %d will have address %p\n", righty->order, right_addr);
 			printf("Adding right half to next lowest order...\n");
-			count_blocks(&free_area[active_order-1]);
+			count_blocks(&a->free_area[active_order-1]);
 #endif
 
 			// Add the right half to the free_area of the next lowest order.
-			list_add(&righty->list, &free_area[active_order-1]);
+			list_add(&righty->list, &a->free_area[active_order-1]);
+			a->free_count[active_order-1]++;
 
 #if USE_DEBUG
-			count_blocks(&free_area[active_order-1]);
+			count_blocks(&a->free_area[active_order-1]);
 #endif
 
 			// Sanity Check:
-			block_t * temp = list_entry(free_area[active_order-1].next, block_t, list);
-			assert(temp->address == righty->address);
+			assert(list_entry(a->free_area[active_order-1].next, block_t, list)->address
+			       == righty->address);
 
 			active_order--;
 			
@@ -371,53 +400,47 @@ void *buddy_alloc(int size)
 
 		lefty->isFree = 0;
 		lefty->order = active_order;
-		list_add_tail(&lefty->list, &free_area[active_order]);
+		list_add_tail(&lefty->list, &a->free_area[active_order]);
 	} // End if(0 == num_splits)
 
+	lefty->flags = 0;
+
 #if USE_DEBUG
-	print_free_area();
+	print_free_area(a);
 #endif
-	
+
+#if USE_CHECK
+	// Anything but poison means someone wrote through a stale pointer
+	if(!poison_intact(lefty->address, lefty->order)){
+		PCHECK("block %p (order %d) was written to while free",
+		       lefty->address, lefty->order);
+	}
+	memset(lefty->address, ALLOC_FILL, (size_t)1 << lefty->order);
+	check_or_die(a, __func__);
+#endif
+
+	BUDDY_TRACE(TRACE_ALLOC, lefty->order, ADDR_TO_PAGE(a, lefty->address));
+	LAT_END(LAT_ALLOC, lefty->order);
+
 	return lefty->address;
 }
 
 
 /**
- * Free an allocated memory block.
+ * @brief Mark an allocated block free and merge it with its free buddies.
  *
- * Whenever a block is freed, the allocator checks its buddy. If the buddy is
- * free as well, then the two buddies are combined to form a bigger block. This
- * process continues until one of the buddies is not free, or no buddies exist.
- *
- * @param addr memory block address to be freed
+ * This is the part of buddy_arena_free after the block has been found and
+ * checked, shared with compaction.
  *
+ * @param block listed block to release
  */
-void buddy_free(void *addr)
+static void release_block(buddy_arena_t *a, block_t *block)
 {
-	int current_order;
-	block_t *block = NULL;
 	block_t *buddy = NULL;
 
-	// Locate the block associate with the address passed in
-	// if it does not exist, error out
-	for(current_order=MIN_ORDER; current_order < MAX_ORDER; ++current_order){
-		block = find_block(addr, current_order);
-		if(NULL != block){
-			break;	
-		}
-	}
-#if USE_DEBUG
-
-	if(NULL == block){
-		printf("[ FREE ERROR: FREE ON FREE PAGE ]\n");
-
-		return;
-	}
-	else{
-		printf("FREEING BLOCK OF ORDER %d (%d bytes)\n", block->order, (1 << block->order));
-		printf("LOCATED THE GIVEN BLOCK...\n");
-	}
-#endif
+	// The block counts as free from here on, whether or not it merges
+	block->isFree = 1;
+	a->free_count[block->order]++;
 
 	// 	Merging follows the pattern:
 	//
@@ -435,10 +458,10 @@ void buddy_free(void *addr)
 	
 
 	// Identify the buddy address which goes with the given address
-	char* buddy_addr = (char*)BUDDY_ADDR(addr, block->order);
+	char* buddy_addr = (char*)BUDDY_ADDR(a, block->address, block->order);
 
 	// locate the block which begins with this address in the free_areas
-	buddy = find_block(buddy_addr, block->order);
+	buddy = find_block(a, buddy_addr, block->order);
 
 	while(NULL != buddy){
 
@@ -452,6 +475,7 @@ void buddy_free(void *addr)
 			// Remove both blocks from the current free_area
 			list_del(&buddy->list);
 			list_del(&block->list);
+			a->free_count[block->order] -= 2;
 
 			// Destroy the block with the larger address. Undangle it.
 			if(block->address < buddy->address){
@@ -469,23 +493,24 @@ void buddy_free(void *addr)
 
 #if USE_DEBUG
 			printf("Adding merged block to order %d\n", block->order);
-			count_blocks(&free_area[block->order]);
+			count_blocks(&a->free_area[block->order]);
 #endif
 
 			// Add the merged block to the now higher order or
 			// block sizes
-			list_add(&block->list, &free_area[block->order]);
+			list_add(&block->list, &a->free_area[block->order]);
+			a->free_count[block->order]++;
 
 #if USE_DEBUG
-			count_blocks(&free_area[block->order]);
+			count_blocks(&a->free_area[block->order]);
 #endif
 
 
 			// Get a new buddy address
-			buddy_addr = (char*)BUDDY_ADDR(block->address, block->order);
+			buddy_addr = (char*)BUDDY_ADDR(a, block->address, block->order);
 
 			// Search for another buddy
-			buddy = find_block(buddy_addr, block->order);
+			buddy = find_block(a, buddy_addr, block->order);
 		}
 		else{
 
@@ -502,14 +527,571 @@ void buddy_free(void *addr)
 	
 	// Mark block as freed
 	block->isFree = 1;
+}
+
+
+/**
+ * Free an allocated memory block.
+ *
+ * Whenever a block is freed, the allocator checks its buddy. If the buddy is
+ * free as well, then the two buddies are combined to form a bigger block. This
+ * process continues until one of the buddies is not free, or no buddies exist.
+ *
+ * @param addr memory block address to be freed
+ *
+ */
+void buddy_arena_free(buddy_arena_t *a, void *addr)
+{
+	int current_order;
+	block_t *block = NULL;
+	int freed_order;
+
+	LAT_BEGIN();
+
+	// Locate the block associate with the address passed in
+	// if it does not exist, error out
+	for(current_order=MIN_ORDER; current_order <= MAX_ORDER; ++current_order){
+		block = find_block(a, addr, current_order);
+		if(NULL != block){
+			break;	
+		}
+	}
+
+#if USE_CHECK
+	if(NULL == block){
+		PCHECK("free of %p rejected: not the start of an allocated block", addr);
+		return;
+	}
+	if(1 == block->isFree){
+		PCHECK("free of %p rejected: double free, order %d block is already free",
+		       addr, block->order);
+		return;
+	}
+
+	// Poison before merging, so merged free blocks are poisoned throughout
+	memset(block->address, FREE_POISON, (size_t)1 << block->order);
+#else
+	// Not a block we handed out, or one already freed: nothing sensible
+	// to do, and releasing it again would count it twice
+	if(NULL == block || 1 == block->isFree){
+		return;
+	}
+#endif
+#if USE_DEBUG
+
+	if(NULL == block){
+		printf("[ FREE ERROR: FREE ON FREE PAGE ]\n");
+
+		return;
+	}
+	else{
+		printf("FREEING BLOCK OF ORDER %d (%zu bytes)\n", block->order, (size_t)1 << block->order);
+		printf("LOCATED THE GIVEN BLOCK...\n");
+	}
+#endif
+
+	BUDDY_TRACE(TRACE_FREE, block->order, ADDR_TO_PAGE(a, block->address));
+	freed_order = block->order;
+
+	release_block(a, block);
+
+	LAT_END(LAT_FREE, freed_order);
+
+#if USE_CHECK
+	check_or_die(a, __func__);
+#endif
 
 #if USE_DEBUG
-	print_free_area();
+	print_free_area(a);
 #endif
 	
 }
 
 
+/**************************************************************************
+ * Compaction
+ **************************************************************************/
+
+/**
+ * @brief Smallest order whose blocks hold size bytes.
+ */
+static int size_to_order(size_t size)
+{
+	int order = MIN_ORDER;
+
+	while (order < MAX_ORDER && ((size_t)1 << order) < size)
+		order++;
+	return order;
+}
+
+
+/**
+ * @brief Pick the region of the given order that is cheapest to empty.
+ *
+ * Blocks are walked in address order by hopping from each block's first
+ * page to the next block's, which reads only the descriptors of listed
+ * blocks.  A region qualifies if every allocated block in it is movable;
+ * the one with the fewest allocated bytes wins.
+ *
+ * @return first page of the region, -1 if none qualifies, or -2 if a free
+ *		block of the order already exists
+ */
+static long pick_region(buddy_arena_t *a, int order)
+{
+	long region_pages = 1l << (order - MIN_ORDER);
+	long best = -1, best_used = 0;
+	long p = 0;
+
+	while (p < (long)BUDDY_ARENA_PAGES) {
+		block_t *blk = &a->pages[p];
+		long start = p, used = 0;
+		int movable = 1;
+
+		if (blk->order >= order) {
+			if (blk->isFree)
+				return -2;
+			p = NEXT_HEAD(a, p);
+			continue;
+		}
+
+		// A region split into smaller blocks
+		for (; p < start + region_pages; p = NEXT_HEAD(a, p)) {
+			blk = &a->pages[p];
+			if (!blk->isFree) {
+				used += 1l << blk->order;
+				movable = movable && (blk->flags & BLOCK_MOVABLE);
+			}
+		}
+		if (movable && (best < 0 || used < best_used)) {
+			best = start;
+			best_used = used;
+		}
+	}
+
+	return best;
+}
+
+
+/**
+ * @brief Allocate a block that compaction may move.
+ */
+void *buddy_arena_alloc_movable(buddy_arena_t *a, size_t size)
+{
+	char *addr = buddy_arena_alloc(a, size);
+
+	if (addr != NULL)
+		a->pages[ADDR_TO_PAGE(a, addr)].flags = BLOCK_MOVABLE;
+	return addr;
+}
+
+
+/**
+ * @brief Register the callback that moves movable blocks.
+ *
+ * Compaction does nothing until one is set.  buddy_arena_init clears it.
+ */
+void buddy_arena_set_relocate(buddy_arena_t *a, buddy_relocate_fn fn, void *arg)
+{
+	a->relocate = fn;
+	a->relocate_arg = arg;
+}
+
+
+/**
+ * @brief Try to make a free block of the given order by moving blocks.
+ *
+ * Picks the region of that order holding the fewest allocated bytes, all
+ * of them movable.  The region's free blocks are held off the free lists,
+ * so new copies can only go elsewhere.  Each allocated block is copied to
+ * a new block, and the relocate callback redirects its users.  Then
+ * everything held back or vacated is freed, and the region merges into
+ * one block.
+ *
+ * With a budget, no further block is moved once the budget has run out,
+ * though every call moves at least one.  The blocks moved so far stay
+ * moved, so the next call picks up where this one stopped.
+ *
+ * @param order order of the block wanted
+ * @param budget_ns time allowed in nanoseconds, 0 for no limit
+ * @return 1 if a free block of the order now exists, 0 if not yet, -1 if
+ *		nothing can be moved
+ */
+int buddy_arena_compact(buddy_arena_t *a, int order, long budget_ns)
+{
+	struct timespec t0, now;
+	long start, end, p, next;
+	int moved = 0, o;
+
+	if (order < MIN_ORDER || order > MAX_ORDER || a->relocate == NULL)
+		return -1;
+
+	start = pick_region(a, order);
+	if (start == -2)
+		return 1;
+	if (start < 0)
+		return -1;
+	end = start + (1l << (order - MIN_ORDER));
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	// Hold the region's free blocks back
+	for (p = start; p < end; p = NEXT_HEAD(a, p)) {
+		block_t *blk = &a->pages[p];
+
+		if (blk->isFree) {
+			blk->isFree = 0;
+			blk->flags = BLOCK_ISOLATED;
+			a->free_count[blk->order]--;
+		}
+	}
+
+	// Move the allocated blocks out
+	for (p = start; p < end; p = NEXT_HEAD(a, p)) {
+		block_t *blk = &a->pages[p];
+		size_t size = (size_t)1 << blk->order;
+		char *to;
+
+		if (blk->flags & BLOCK_ISOLATED)
+			continue;
+
+		// At least one block moves per call, so repeated calls progress
+		if (budget_ns > 0 && moved > 0) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if ((now.tv_sec - t0.tv_sec) * 1000000000l +
+			    (now.tv_nsec - t0.tv_nsec) > budget_ns)
+				break;
+		}
+
+		to = buddy_arena_alloc_movable(a, size);
+		if (to == NULL)
+			break;
+		memcpy(to, blk->address, size);
+		if (a->relocate(blk->address, to, size, a->relocate_arg) != 0) {
+			buddy_arena_free(a, to);
+			continue;
+		}
+
+		BUDDY_TRACE(TRACE_FREE, blk->order, p);
+		blk->flags = BLOCK_ISOLATED;
+		moved++;
+#if USE_CHECK
+		memset(blk->address, FREE_POISON, size);
+#endif
+	}
+
+	// Free everything held back or vacated. Nothing ahead of p is free,
+	// so merging never changes the blocks still to be visited.
+	for (p = start; p < end; p = next) {
+		block_t *blk = &a->pages[p];
+
+		next = NEXT_HEAD(a, p);
+		if (blk->flags & BLOCK_ISOLATED) {
+			blk->flags = 0;
+			release_block(a, blk);
+		}
+	}
+
+#if USE_CHECK
+	check_or_die(a, __func__);
+#endif
+
+	for (o = order; o <= MAX_ORDER; o++) {
+		if (a->free_count[o] > 0)
+			return 1;
+	}
+	return 0;
+}
+
+
+/**************************************************************************
+ * Placed Allocation
+ **************************************************************************/
+
+/**
+ * @brief Allocate the block of the given size at a fixed offset.
+ *
+ * Finds the free block that contains the range and splits it down the
+ * buddy tree towards the offset, freeing the halves that fall outside, as
+ * buddy_arena_alloc does with right halves.  Fails if the offset is not
+ * aligned to the block size or any part of the range is in use.
+ *
+ * @param offset offset of the block from the start of the arena
+ * @param size size in bytes, rounded up to a block size
+ * @return memory block address, or NULL
+ */
+void *buddy_arena_alloc_at(buddy_arena_t *a, size_t offset, size_t size)
+{
+	block_t *block = NULL;
+	int order, o;
+
+	if (size > BUDDY_ARENA_BYTES)
+		return NULL;
+	order = size_to_order(size);
+	if (offset & (((size_t)1 << order) - 1) || offset >= BUDDY_ARENA_BYTES)
+		return NULL;
+
+	// Exactly one listed block covers the offset; it must be free and
+	// at least as big as the request
+	for (o = order; o <= MAX_ORDER && block == NULL; o++) {
+		block = find_block(a, a->memory + (offset & ~(((size_t)1 << o) - 1)), o);
+	}
+	if (block == NULL || !block->isFree)
+		return NULL;
+
+	o = block->order;
+	list_del(&block->list);
+	a->free_count[o]--;
+
+	while (o > order) {
+		char *half = block->address + ((size_t)1 << (o - 1));
+		block_t *left = block;
+		block_t *right = &a->pages[ADDR_TO_PAGE(a, half)];
+		block_t *spare;
+
+		o--;
+		right->order = o;
+		right->address = half;
+		right->flags = 0;
+		left->order = o;
+
+		// Keep the half holding the offset, free the other
+		if (offset >= (size_t)(half - a->memory)) {
+			block = right;
+			spare = left;
+		} else {
+			spare = right;
+		}
+		spare->isFree = 1;
+		list_add(&spare->list, &a->free_area[o]);
+		a->free_count[o]++;
+	}
+
+	block->isFree = 0;
+	block->flags = 0;
+	list_add_tail(&block->list, &a->free_area[order]);
+
+#if USE_CHECK
+	if(!poison_intact(block->address, order)){
+		PCHECK("block %p (order %d) was written to while free",
+		       block->address, order);
+	}
+	memset(block->address, ALLOC_FILL, (size_t)1 << order);
+	check_or_die(a, __func__);
+#endif
+
+	BUDDY_TRACE(TRACE_ALLOC, order, ADDR_TO_PAGE(a, block->address));
+
+	return block->address;
+}
+
+
+/**
+ * @brief Largest block that starts at off and ends by end.
+ */
+static int range_order(size_t off, size_t end)
+{
+	int o = MAX_ORDER;
+
+	while (o > MIN_ORDER && ((off & (((size_t)1 << o) - 1)) || off + ((size_t)1 << o) > end))
+		o--;
+	return o;
+}
+
+
+/**
+ * @brief Claim a range of pages, such as a guard or a fixed-layout area.
+ *
+ * The range is widened to whole pages and cut into the fewest aligned
+ * blocks that cover it, each taken with buddy_arena_alloc_at.  The blocks
+ * are ordinary allocated blocks, so nothing costs more afterwards.
+ *
+ * @return 0, or -1 with nothing claimed if any part of the range is in use
+ */
+int buddy_arena_reserve(buddy_arena_t *a, size_t offset, size_t size)
+{
+	size_t off = offset & ~(PAGE_SIZE - 1);
+	size_t end = (offset + size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	int o;
+
+	if (end > BUDDY_ARENA_BYTES || end < off)
+		return -1;
+
+	for (; off < end; off += (size_t)1 << o) {
+		o = range_order(off, end);
+		if (buddy_arena_alloc_at(a, off, (size_t)1 << o) == NULL) {
+			buddy_arena_unreserve(a, offset, off - offset);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * @brief Give back a range claimed with buddy_arena_reserve.
+ */
+void buddy_arena_unreserve(buddy_arena_t *a, size_t offset, size_t size)
+{
+	size_t off = offset & ~(PAGE_SIZE - 1);
+	size_t end = (offset + size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	int o;
+
+	for (; off < end && end <= BUDDY_ARENA_BYTES; off += (size_t)1 << o) {
+		o = range_order(off, end);
+		buddy_arena_free(a, a->memory + off);
+	}
+}
+
+
+/**
+ * @brief Walk the whole heap and report every inconsistency on stderr.
+ *
+ * Every page must be covered by exactly one list entry, each entry must sit
+ * on the list of its own order at an address aligned to that order, the page
+ * descriptor must be the entry for its address, two free buddies must never
+ * share an order, free memory must still hold its poison, and each order's
+ * free counter must match its list.
+ *
+ * @return number of problems found, always 0 unless built with USE_CHECK
+ */
+int buddy_arena_check(buddy_arena_t *a)
+{
+#if USE_CHECK
+	// Per call, as each NUMA arena is checked under its own lock.  Mapped
+	// rather than malloced, since in libbuddymalloc malloc is this heap.
+	unsigned char *covered = mmap(NULL, BUDDY_ARENA_PAGES, PROT_READ | PROT_WRITE,
+				      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	size_t n_pages = BUDDY_ARENA_PAGES;
+	size_t i;
+	int errors = 0;
+	int o;
+
+	if (MAP_FAILED == covered) {
+		PCHECK("no memory for the page map, heap not checked");
+		return 1;
+	}
+
+	for (o = MIN_ORDER; o <= MAX_ORDER; o++) {
+		struct list_head *pos;
+		int n_free = 0;
+		list_for_each(pos, &a->free_area[o]) {
+			block_t *blk = list_entry(pos, block_t, list);
+			size_t off = (size_t)(blk->address - a->memory);
+
+			if (!buddy_arena_contains(a, blk->address)) {
+				PCHECK("block %p on order %d list is outside the arena",
+				       blk->address, o);
+				errors++;
+				continue;
+			}
+			if (blk->order != o) {
+				PCHECK("block %p has order %d but is on the order %d list",
+				       blk->address, blk->order, o);
+				errors++;
+			}
+			if (off & (((size_t)1 << o) - 1)) {
+				PCHECK("block %p is not aligned to order %d", blk->address, o);
+				errors++;
+			}
+			if (&a->pages[ADDR_TO_PAGE(a, blk->address)] != blk) {
+				PCHECK("block %p is not the page descriptor for its address",
+				       blk->address);
+				errors++;
+			}
+			if (blk->isFree != 0 && blk->isFree != 1) {
+				PCHECK("block %p has free flag %d", blk->address, blk->isFree);
+				errors++;
+			}
+
+			// Claim the pages, any page claimed twice is an overlap
+			for (i = off / PAGE_SIZE; i < (off + ((size_t)1 << o)) / PAGE_SIZE && i < n_pages; i++) {
+				if (covered[i]++) {
+					PCHECK("block %p (order %d) overlaps another block at page %zu",
+					       blk->address, o, i);
+					errors++;
+				}
+			}
+
+			if (1 != blk->isFree) {
+				continue;
+			}
+			n_free++;
+			if (o < MAX_ORDER) {
+				block_t *buddy = find_block(a, (char *)BUDDY_ADDR(a, blk->address, o), o);
+				if (NULL != buddy && 1 == buddy->isFree) {
+					PCHECK("free buddies %p and %p were not merged at order %d",
+					       blk->address, buddy->address, o);
+					errors++;
+				}
+			}
+			if (!poison_intact(blk->address, o)) {
+				PCHECK("free block %p (order %d) was written to",
+				       blk->address, o);
+				errors++;
+			}
+		}
+		if (n_free != a->free_count[o]) {
+			PCHECK("order %d list has %d free blocks but the counter says %d",
+			       o, n_free, a->free_count[o]);
+			errors++;
+		}
+	}
+
+	for (i = 0; i < n_pages; i++) {
+		if (!covered[i]) {
+			PCHECK("page %zu (%p) is not covered by any block", i, PAGE_TO_ADDR(a, i));
+			errors++;
+		}
+	}
+
+	munmap(covered, BUDDY_ARENA_PAGES);
+	return errors;
+#else
+	return 0;
+#endif
+}
+
+
+#if USE_CHECK
+/**
+ * @brief Report whether a block of memory still holds FREE_POISON throughout.
+ */
+int poison_intact(char *addr, int order)
+{
+	size_t i;
+	for (i = 0; i < ((size_t)1 << order); i++) {
+		if ((unsigned char)addr[i] != FREE_POISON) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+/**
+ * @brief Abort with the caller's name if the heap fails buddy_check.
+ */
+void check_or_die(buddy_arena_t *a, const char *where)
+{
+	int errors = buddy_arena_check(a);
+	if (errors) {
+		PCHECK("%d heap consistency errors after %s()", errors, where);
+		abort();
+	}
+}
+#endif
+
+
+/**
+ * @brief Report whether the latency hooks were compiled in.  The heap in
+ *		buddy_cxx.cpp has none, so its builds report them off.
+ */
+int buddy_latency_enabled()
+{
+	return USE_LATENCY && !BUDDY_CXX_HEAP;
+}
+
+
 /**
  * @brief print free pages in each order.
  *
@@ -519,22 +1101,138 @@ void buddy_free(void *addr)
  */
 void buddy_dump()
 {
-#if USE_DEBUG
-	buddy_dump_verbose();
+#if USE_DEBUG && !BUDDY_CXX_HEAP
+	buddy_dump_verbose(default_arena);
 #endif
 	int o;
 	for (o = MIN_ORDER; o <= MAX_ORDER; o++) {
-		struct list_head *pos;
-		int cnt = 0;
-		list_for_each(pos, &free_area[o]) {
-			block_t * temp = list_entry(pos, block_t, list);
-			if(temp->isFree == 1){
-				cnt++;
+		printf("%d:%zuK ", buddy_free_count(o), ((size_t)1 << o) / 1024);
+	}
+	printf("\n");
+}
+
+
+/* Pending buddy_dump_buffered output, written out by buddy_dump_flush */
+static char dump_buf[1 << 16];
+static size_t dump_len;
+
+/* Longest line buddy_dump_buffered can add: a count and a size per order */
+#define DUMP_LINE_MAX ((MAX_ORDER - MIN_ORDER + 1) * 36 + 1)
+
+
+/**
+ * @brief Write the pending buffered dump output to standard output.
+ *
+ * Anything already buffered in stdio goes out first, so output from printf
+ * and from buddy_dump_buffered stays in the order it was produced.
+ */
+void buddy_dump_flush()
+{
+	size_t done = 0;
+
+	if (0 == dump_len) {
+		return;
+	}
+	fflush(stdout);
+	while (done < dump_len) {
+		ssize_t n = write(STDOUT_FILENO, dump_buf + done, dump_len - done);
+		if (n <= 0) {
+			break;
+		}
+		done += n;
+	}
+	dump_len = 0;
+}
+
+
+/**
+ * @brief Same output as buddy_dump, formatted by hand into a buffer that is
+ * 		only written out when full or on buddy_dump_flush.
+ *
+ * @note Call buddy_dump_flush before writing to stdout any other way.
+ */
+void buddy_dump_buffered()
+{
+	char *p;
+	int o;
+
+	if (dump_len + DUMP_LINE_MAX > sizeof(dump_buf)) {
+		buddy_dump_flush();
+	}
+
+	p = dump_buf + dump_len;
+	for (o = MIN_ORDER; o <= MAX_ORDER; o++) {
+		char digits[24];
+		int n = 0;
+		size_t v = buddy_free_count(o);
+
+		// Count, then ":<size>K "
+		do {
+			digits[n++] = '0' + v % 10;
+			v /= 10;
+		} while (v);
+		while (n) {
+			*p++ = digits[--n];
+		}
+		*p++ = ':';
+
+		v = ((size_t)1 << o) / 1024;
+		do {
+			digits[n++] = '0' + v % 10;
+			v /= 10;
+		} while (v);
+		while (n) {
+			*p++ = digits[--n];
+		}
+		*p++ = 'K';
+		*p++ = ' ';
+	}
+	*p++ = '\n';
+	dump_len = p - dump_buf;
+}
+
+
+/**
+ * @brief Count the free blocks of the given order.
+ *
+ * @return number of free blocks, 0 for orders outside [MIN_ORDER, MAX_ORDER]
+ */
+int buddy_arena_free_count(const buddy_arena_t *a, int order)
+{
+	if (order < MIN_ORDER || order > MAX_ORDER) {
+		return 0;
+	}
+	return a->free_count[order];
+}
+
+
+/**
+ * @brief List the free blocks of the given order, as offsets from the start
+ * 		of the arena, in the order buddy_alloc would hand them out.
+ *
+ * @param order order to list
+ * @param offsets filled with up to max offsets
+ * @param max room in offsets
+ * @return number of free blocks, which may be more than max
+ */
+int buddy_arena_free_offsets(const buddy_arena_t *a, int order, size_t *offsets, int max)
+{
+	struct list_head *pos;
+	int cnt = 0;
+
+	if (order < MIN_ORDER || order > MAX_ORDER) {
+		return 0;
+	}
+	list_for_each(pos, &a->free_area[order]) {
+		block_t *blk = list_entry(pos, block_t, list);
+		if (1 == blk->isFree) {
+			if (cnt < max) {
+				offsets[cnt] = (size_t)(blk->address - a->memory);
 			}
+			cnt++;
 		}
-		printf("%d:%dK ", cnt, (1<<o)/1024);
 	}
-	printf("\n");
+	return cnt;
 }
 
 
@@ -542,20 +1240,20 @@ void buddy_dump()
  * @brief Print a more useful and thorough dump of the free area
  *
  */
-void buddy_dump_verbose(){
+void buddy_dump_verbose(buddy_arena_t *a){
 	int o;
 	for (o = MIN_ORDER; o <= MAX_ORDER; o++) {
 		struct list_head *pos;
 		int cnt = 0;
 		int total = 0;
-		list_for_each(pos, &free_area[o]) {
+		list_for_each(pos, &a->free_area[o]) {
 			block_t * temp = list_entry(pos, block_t, list);
 			total++;
 			if(1 == temp->isFree){
 				cnt++;
 			}
 		}
-		printf("(%d/%d):%dK ", cnt, total, (1<<o)/1024);
+		printf("(%d/%d):%zuK ", cnt, total, ((size_t)1 << o) / 1024);
 	}
 	printf("\n");
 	
@@ -570,10 +1268,11 @@ void buddy_dump_verbose(){
  * TODO Figure out why changes herein are not persistent in the block_t types
  * passed in.
  */
-void merge(block_t *block, block_t *buddy){
+void merge(buddy_arena_t *a, block_t *block, block_t *buddy){
 	// Remove both blocks from the current free_area
 	list_del(&buddy->list);
 	list_del(&block->list);
+	a->free_count[block->order] -= block->isFree + buddy->isFree;
 
 	// Destroy the block with the larger address. Undangle it.
 	if(block->address < buddy->address){
@@ -591,11 +1290,12 @@ void merge(block_t *block, block_t *buddy){
 
 #if USE_DEBUG
 	printf("Adding merged block to order %d\n", block->order);
-	count_blocks(&free_area[block->order]);
+	count_blocks(&a->free_area[block->order]);
 #endif
-	list_add(&block->list, &free_area[block->order]);
+	list_add(&block->list, &a->free_area[block->order]);
+	a->free_count[block->order] += block->isFree;
 #if USE_DEBUG
-	count_blocks(&free_area[block->order]);
+	count_blocks(&a->free_area[block->order]);
 #endif
 
 }
@@ -606,15 +1306,15 @@ void merge(block_t *block, block_t *buddy){
  * @brief Print free areas in a tabular format, similar to the buddy allocator
  * 		slides and examples
  */
-void  print_free_area(){
+void  print_free_area(buddy_arena_t *a){
 	
 	int i;
 	for(i=MAX_ORDER; i >= MIN_ORDER; i--){
 		struct list_head *pos;
-		printf("Order %d, %d bytes\n", i, (1 << i));
+		printf("Order %d, %zu bytes\n", i, (size_t)1 << i);
 		printf(" --------------------------------------------------------------- \n");
 		printf(" | ");
-		list_for_each(pos, &free_area[i]){
+		list_for_each(pos, &a->free_area[i]){
 			block_t * temp = list_entry(pos, block_t, list);
 			if(1 == temp->isFree){
 				printf("%p, F", temp->address);
@@ -657,11 +1357,17 @@ void print_block(block_t * block){
  * @brief Locate and return a pointer to a free block in the given order among
  * 		the free_area, or NULL if no such block exists.
  */
-block_t* find_free_block(int order){
+block_t* find_free_block(buddy_arena_t *a, int order){
 
 	block_t * ret;
 	struct list_head * p;
-	list_for_each(p, &free_area[order]){
+
+	// Most lists hold only allocated blocks, or none at all
+	if(0 == a->free_count[order]){
+		return NULL;
+	}
+
+	list_for_each(p, &a->free_area[order]){
 		ret = list_entry(p, block_t, list);
 
 		if(1 == ret->isFree){
@@ -677,7 +1383,7 @@ block_t* find_free_block(int order){
  * 		within the free area of the given order.  Return NULL if
  * 		no such block exists.
  */
-block_t* find_block(char* addr, int order){
+block_t* find_block(buddy_arena_t *a, char* addr, int order){
 
 #if USE_DEBUG
 	printf("Searching order %d for %p...\n", order, addr);
@@ -685,7 +1391,7 @@ block_t* find_block(char* addr, int order){
 
 	block_t * ret;
 	struct list_head *p;
-	list_for_each(p, &free_area[order]){
+	list_for_each(p, &a->free_area[order]){
 		ret = list_entry(p, block_t, list);
 		if(ret->address == addr){
 #if USE_DEBUG
@@ -705,3 +1411,164 @@ block_t* find_block(char* addr, int order){
 #endif
 	return NULL;
 }
+
+
+/**************************************************************************
+ * Default Arena
+ **************************************************************************/
+#if !BUDDY_CXX_HEAP
+
+/**
+ * @brief Map memory that is only backed by pages as they are touched.
+ */
+static void *map_lazy(size_t len)
+{
+	void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "buddy: cannot map %zu bytes for the heap\n", len);
+		abort();
+	}
+	return p;
+}
+
+
+/**
+ * @brief Allocate from an arena, compacting it once if that fails and
+ *		blocks can be moved.
+ */
+static void *alloc_compacting(buddy_arena_t *a, size_t size, int movable)
+{
+	void *addr = movable ? buddy_arena_alloc_movable(a, size) : buddy_arena_alloc(a, size);
+
+	if (addr == NULL && a->relocate != NULL && size <= BUDDY_ARENA_BYTES &&
+	    buddy_arena_compact(a, size_to_order(size), 0) > 0)
+		addr = movable ? buddy_arena_alloc_movable(a, size) : buddy_arena_alloc(a, size);
+	return addr;
+}
+
+
+/**
+ * @brief Set up the default arena over g_memory, mapping both on the first
+ *		call.
+ */
+void buddy_init()
+{
+	if (default_arena == NULL) {
+		default_arena = map_lazy(sizeof(buddy_arena_t));
+		g_memory = map_lazy(BUDDY_ARENA_BYTES);
+	}
+	buddy_arena_init(default_arena, g_memory);
+}
+
+
+/**
+ * @brief Allocate from the default arena, see buddy_arena_alloc.  Once a
+ *		relocate callback is set, a failed allocation compacts and
+ *		retries.  Once buddy_numa_init has run, the caller's node
+ *		serves instead, falling back to the other nodes.
+ */
+void *buddy_alloc(size_t size)
+{
+	if (buddy_numa_nodes() > 0)
+		return buddy_numa_alloc(size);
+	return alloc_compacting(default_arena, size, 0);
+}
+
+
+/**
+ * @brief Allocate a block from the default arena that compaction may move.
+ */
+void *buddy_alloc_movable(size_t size)
+{
+	return alloc_compacting(default_arena, size, 1);
+}
+
+
+/**
+ * @brief Allocate at an offset in the default arena, see
+ *		buddy_arena_alloc_at.
+ */
+void *buddy_alloc_at(size_t offset, size_t size)
+{
+	return buddy_arena_alloc_at(default_arena, offset, size);
+}
+
+
+/**
+ * @brief Claim a range of the default arena, see buddy_arena_reserve.
+ */
+int buddy_reserve(size_t offset, size_t size)
+{
+	return buddy_arena_reserve(default_arena, offset, size);
+}
+
+
+/**
+ * @brief Give back a range of the default arena.
+ */
+void buddy_unreserve(size_t offset, size_t size)
+{
+	buddy_arena_unreserve(default_arena, offset, size);
+}
+
+
+/**
+ * @brief Free to the default arena, see buddy_arena_free, or to the node
+ *		arena that holds addr.
+ */
+void buddy_free(void *addr)
+{
+	if (buddy_numa_nodes() > 0 && buddy_numa_node_of(addr) >= 0) {
+		buddy_numa_free(addr);
+		return;
+	}
+	buddy_arena_free(default_arena, addr);
+}
+
+
+/**
+ * @brief Set the default arena's relocate callback.
+ */
+void buddy_set_relocate(buddy_relocate_fn fn, void *arg)
+{
+	buddy_arena_set_relocate(default_arena, fn, arg);
+}
+
+
+/**
+ * @brief Compact the default arena, see buddy_arena_compact.
+ */
+int buddy_compact(int order, long budget_ns)
+{
+	return buddy_arena_compact(default_arena, order, budget_ns);
+}
+
+
+/**
+ * @brief Check the default arena, see buddy_arena_check.
+ */
+int buddy_check()
+{
+	return buddy_arena_check(default_arena);
+}
+
+
+/**
+ * @brief Free blocks of an order in the default arena.
+ */
+int buddy_free_count(int order)
+{
+	return buddy_arena_free_count(default_arena, order);
+}
+
+
+/**
+ * @brief Free block offsets of an order in the default arena.
+ */
+int buddy_free_offsets(int order, size_t *offsets, int max)
+{
+	return buddy_arena_free_offsets(default_arena, order, offsets, max);
+}
+#endif
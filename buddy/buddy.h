@@ -1,9 +1,37 @@
 #ifndef BUDDY_H
 #define BUDDY_H
 
+#include <stddef.h>
+
+#define MIN_ORDER 12	// Represents the power of 2 of the minimum block size in bytes
+
+// Represents the power of 2 of the maximum block size in bytes, which is
+// also the size of the heap; set with -DBUDDY_MAX_ORDER=n in CMake
+#ifndef MAX_ORDER
+#  define MAX_ORDER 20
+#endif
+
+/*
+ * Moves a movable block during compaction.  The contents have already been
+ * copied from old_addr to new_addr; return 0 once every reference to the
+ * block points at new_addr, or nonzero to leave the block where it was.
+ */
+typedef int (*buddy_relocate_fn)(void *old_addr, void *new_addr, size_t size, void *arg);
+
 void buddy_init();
-void *buddy_alloc(int size);
+void *buddy_alloc(size_t size);
+void *buddy_alloc_movable(size_t size);
+void *buddy_alloc_at(size_t offset, size_t size);
 void buddy_free(void *addr);
+int buddy_reserve(size_t offset, size_t size);
+void buddy_unreserve(size_t offset, size_t size);
+void buddy_set_relocate(buddy_relocate_fn fn, void *arg);
+int buddy_compact(int order, long budget_ns);
 void buddy_dump();
+void buddy_dump_buffered();
+void buddy_dump_flush();
+int buddy_check();
+int buddy_free_count(int order);
+int buddy_free_offsets(int order, size_t *offsets, int max);
 
 #endif // BUDDY_H
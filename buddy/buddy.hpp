@@ -0,0 +1,381 @@
+#ifndef BUDDY_HPP
+#define BUDDY_HPP
+
+/*
+ * Header-only buddy allocator.
+ *
+ * BuddyAllocator<MinOrder, MaxOrder> is the allocator of buddy.c with its
+ * geometry fixed at compile time: the arena and the page descriptors are
+ * members sized from the template arguments, the order of a request comes
+ * from a count of leading zeros instead of a loop, block sizes and page
+ * counts per order are constexpr tables, and list links are the smallest
+ * integer type that can index every page.  A small pool such as
+ * BuddyAllocator<6, 12> is a few hundred bytes of state that the compiler
+ * can inline and unroll completely.
+ *
+ * The list discipline is the one buddy.c uses, so the same calls give the
+ * same blocks: allocated blocks stay on the list of their order, the first
+ * free block on a list is taken, a split pushes right halves on the list
+ * head and the allocated left half on the tail, and a merge pushes the
+ * merged block on the head of the next order up.  Unlike buddy.c, a block
+ * is found from its address in O(1) through a flag on its first page,
+ * which init has to clear on every page, and bad or double frees are
+ * ignored.
+ *
+ * buddy_cxx.cpp puts the buddy.h API on one instance, which the BUDDY_CXX
+ * build option makes the heap of the libraries.
+ */
+
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace buddy_detail {
+
+// Block bytes and pages of every order, indexed by order - MinOrder
+template <unsigned MinOrder, unsigned Orders, typename Index>
+struct OrderTable {
+	std::size_t bytes[Orders];
+	Index pages[Orders];
+
+	constexpr OrderTable() noexcept : bytes{}, pages{}
+	{
+		for (unsigned o = 0; o < Orders; o++) {
+			bytes[o] = std::size_t(1) << (MinOrder + o);
+			pages[o] = static_cast<Index>(std::size_t(1) << o);
+		}
+	}
+};
+
+} // namespace buddy_detail
+
+template <unsigned MinOrder, unsigned MaxOrder>
+class BuddyAllocator {
+	static_assert(MinOrder <= MaxOrder, "MinOrder must not exceed MaxOrder");
+	static_assert(MaxOrder < sizeof(std::size_t) * CHAR_BIT, "MaxOrder too large for size_t");
+	static_assert(MaxOrder - MinOrder < 32, "too many pages for 32-bit list links");
+
+public:
+	static constexpr unsigned min_order = MinOrder;
+	static constexpr unsigned max_order = MaxOrder;
+	static constexpr unsigned orders = MaxOrder - MinOrder + 1;
+	static constexpr std::size_t page_size = std::size_t(1) << MinOrder;
+	static constexpr std::size_t arena_bytes = std::size_t(1) << MaxOrder;
+	static constexpr std::size_t n_pages = arena_bytes / page_size;
+
+	// Smallest order whose blocks hold size bytes, MaxOrder + 1 if none do
+	static constexpr unsigned order_for(std::size_t size) noexcept
+	{
+		if (size <= page_size)
+			return MinOrder;
+		if (size > arena_bytes)
+			return MaxOrder + 1;
+		return sizeof(unsigned long long) * CHAR_BIT -
+		       __builtin_clzll(static_cast<unsigned long long>(size - 1));
+	}
+
+	// Bytes in a block of an order in [MinOrder, MaxOrder]
+	static constexpr std::size_t block_size(unsigned order) noexcept
+	{
+		return order_table.bytes[order - MinOrder];
+	}
+
+	BuddyAllocator() noexcept { init(); }
+	BuddyAllocator(const BuddyAllocator &) = delete;
+	BuddyAllocator &operator=(const BuddyAllocator &) = delete;
+
+	// Make the whole arena one free block again
+	void init() noexcept
+	{
+		for (unsigned o = 0; o < orders; o++) {
+			head_[o] = tail_[o] = nil;
+			count_[o] = 0;
+		}
+		// Addresses are looked up through the head flags, so those must
+		// all be clear; the other fields are written when a block forms
+		for (std::size_t i = 1; i < n_pages; i++)
+			pages_[i].head = 0;
+		pages_[0] = Page{ nil, nil, static_cast<std::uint8_t>(MaxOrder), 1, 1 };
+		push_head(MaxOrder, 0);
+		count_[orders - 1] = 1;
+	}
+
+	void *allocate(std::size_t size) noexcept
+	{
+		const unsigned target = order_for(size);
+		unsigned o;
+		index_t i = nil;
+
+		if (target > MaxOrder)
+			return nullptr;
+
+		for (o = target; o <= MaxOrder; o++) {
+			if (count_[o - MinOrder] && (i = first_free(o)) != nil)
+				break;
+		}
+		if (i == nil)
+			return nullptr;
+
+		count_[o - MinOrder]--;
+		if (o == target) {
+			pages_[i].free = 0;
+			return address(i);
+		}
+
+		unlink(o, i);
+		while (o > target) {
+			o--;
+			const index_t r = i + pages_in(o);
+			pages_[r] = Page{ nil, nil, static_cast<std::uint8_t>(o), 1, 1 };
+			push_head(o, r);
+			count_[o - MinOrder]++;
+		}
+		pages_[i].order = static_cast<std::uint8_t>(target);
+		pages_[i].free = 0;
+		push_tail(target, i);
+		return address(i);
+	}
+
+	void deallocate(void *p) noexcept
+	{
+		index_t i = block_of(p);
+
+		if (i == nil || pages_[i].free)
+			return;
+
+		unsigned o = pages_[i].order;
+		pages_[i].free = 1;
+		count_[o - MinOrder]++;
+
+		while (o < MaxOrder) {
+			const index_t b = i ^ pages_in(o);
+			if (!pages_[b].head || pages_[b].order != o || !pages_[b].free)
+				break;
+
+			unlink(o, b);
+			unlink(o, i);
+			count_[o - MinOrder] -= 2;
+
+			// The higher half stops being a block
+			const index_t lo = i < b ? i : b;
+			pages_[i ^ b ^ lo].head = 0;
+			i = lo;
+			o++;
+			pages_[i].order = static_cast<std::uint8_t>(o);
+			push_head(o, i);
+			count_[o - MinOrder]++;
+		}
+	}
+
+	// The block of the given size at offset, or nullptr if it is misaligned
+	// or any part of it is in use
+	void *allocate_at(std::size_t offset, std::size_t size) noexcept
+	{
+		const unsigned target = order_for(size);
+		index_t i = nil;
+		unsigned o;
+
+		if (target > MaxOrder || (offset & (block_size(target) - 1)) || offset >= arena_bytes)
+			return nullptr;
+
+		// The one block that covers the offset must be free and big enough
+		for (o = target; o <= MaxOrder; o++) {
+			const index_t c = static_cast<index_t>((offset & ~(block_size(o) - 1)) / page_size);
+			if (pages_[c].head && pages_[c].order == o) {
+				i = c;
+				break;
+			}
+		}
+		if (i == nil || !pages_[i].free)
+			return nullptr;
+
+		unlink(o, i);
+		count_[o - MinOrder]--;
+
+		while (o > target) {
+			o--;
+			const index_t r = i + pages_in(o);
+			pages_[r] = Page{ nil, nil, static_cast<std::uint8_t>(o), 1, 1 };
+			pages_[i].order = static_cast<std::uint8_t>(o);
+
+			// Keep the half holding the offset, free the other
+			index_t spare = r;
+			if (offset >= std::size_t(r) * page_size) {
+				spare = i;
+				i = r;
+			}
+			pages_[spare].free = 1;
+			push_head(o, spare);
+			count_[o - MinOrder]++;
+		}
+		pages_[i].free = 0;
+		push_tail(target, i);
+		return address(i);
+	}
+
+	// Claim [offset, offset + size) widened to whole pages, all or nothing
+	bool reserve(std::size_t offset, std::size_t size) noexcept
+	{
+		std::size_t off = offset & ~(page_size - 1);
+		const std::size_t end = (offset + size + page_size - 1) & ~(page_size - 1);
+
+		if (end > arena_bytes || end < off)
+			return false;
+		for (unsigned o; off < end; off += block_size(o)) {
+			o = range_order(off, end);
+			if (!allocate_at(off, block_size(o))) {
+				unreserve(offset, off - offset);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void unreserve(std::size_t offset, std::size_t size) noexcept
+	{
+		std::size_t off = offset & ~(page_size - 1);
+		const std::size_t end = (offset + size + page_size - 1) & ~(page_size - 1);
+
+		for (unsigned o; off < end && end <= arena_bytes; off += block_size(o)) {
+			o = range_order(off, end);
+			deallocate(memory_ + off);
+		}
+	}
+
+	int free_count(unsigned order) const noexcept
+	{
+		return order < MinOrder || order > MaxOrder ? 0 : count_[order - MinOrder];
+	}
+
+	// Offsets of the free blocks of an order, in list order
+	int free_offsets(unsigned order, std::size_t *offsets, int max) const noexcept
+	{
+		int n = 0;
+
+		if (order < MinOrder || order > MaxOrder)
+			return 0;
+		for (index_t i = head_[order - MinOrder]; i != nil; i = pages_[i].next) {
+			if (pages_[i].free) {
+				if (n < max)
+					offsets[n] = std::size_t(i) * page_size;
+				n++;
+			}
+		}
+		return n;
+	}
+
+	// Number of counters that disagree with their lists
+	int check() const noexcept
+	{
+		int errors = 0;
+
+		for (unsigned o = MinOrder; o <= MaxOrder; o++)
+			errors += free_offsets(o, nullptr, 0) != count_[o - MinOrder];
+		return errors;
+	}
+
+	bool contains(const void *p) const noexcept
+	{
+		return static_cast<const unsigned char *>(p) >= memory_ &&
+		       static_cast<const unsigned char *>(p) < memory_ + arena_bytes;
+	}
+
+	unsigned char *memory() noexcept { return memory_; }
+
+private:
+	// Link type: the smallest that indexes every page and still has a
+	// spare value to end lists with
+	using index_t = std::conditional_t<(n_pages < 0xff), std::uint8_t,
+			std::conditional_t<(n_pages < 0xffff), std::uint16_t, std::uint32_t>>;
+
+	static constexpr index_t nil = static_cast<index_t>(~index_t(0));
+
+	struct Page {
+		index_t next;
+		index_t prev;
+		std::uint8_t order;
+		std::uint8_t free;
+		std::uint8_t head;	// First page of a block
+	};
+
+	static constexpr buddy_detail::OrderTable<MinOrder, orders, index_t> order_table{};
+
+	static constexpr index_t pages_in(unsigned order) noexcept
+	{
+		return order_table.pages[order - MinOrder];
+	}
+
+	static constexpr unsigned range_order(std::size_t off, std::size_t end) noexcept
+	{
+		unsigned o = MaxOrder;
+		while (o > MinOrder && ((off & (block_size(o) - 1)) || off + block_size(o) > end))
+			o--;
+		return o;
+	}
+
+	void *address(index_t i) noexcept { return memory_ + std::size_t(i) * page_size; }
+
+	// Head page of the block at p, or nil if p does not start a block
+	index_t block_of(const void *p) const noexcept
+	{
+		if (!contains(p))
+			return nil;
+		const std::size_t off = static_cast<const unsigned char *>(p) - memory_;
+		const index_t i = static_cast<index_t>(off / page_size);
+		return off % page_size == 0 && pages_[i].head ? i : nil;
+	}
+
+	index_t first_free(unsigned order) const noexcept
+	{
+		index_t i = head_[order - MinOrder];
+		while (i != nil && !pages_[i].free)
+			i = pages_[i].next;
+		return i;
+	}
+
+	void push_head(unsigned order, index_t i) noexcept
+	{
+		index_t &h = head_[order - MinOrder];
+		pages_[i].prev = nil;
+		pages_[i].next = h;
+		if (h != nil)
+			pages_[h].prev = i;
+		else
+			tail_[order - MinOrder] = i;
+		h = i;
+	}
+
+	void push_tail(unsigned order, index_t i) noexcept
+	{
+		index_t &t = tail_[order - MinOrder];
+		pages_[i].next = nil;
+		pages_[i].prev = t;
+		if (t != nil)
+			pages_[t].next = i;
+		else
+			head_[order - MinOrder] = i;
+		t = i;
+	}
+
+	void unlink(unsigned order, index_t i) noexcept
+	{
+		Page &p = pages_[i];
+		if (p.prev != nil)
+			pages_[p.prev].next = p.next;
+		else
+			head_[order - MinOrder] = p.next;
+		if (p.next != nil)
+			pages_[p.next].prev = p.prev;
+		else
+			tail_[order - MinOrder] = p.prev;
+	}
+
+	alignas(page_size < 4096 ? page_size : 4096) unsigned char memory_[arena_bytes];
+	Page pages_[n_pages];
+	index_t head_[orders];
+	index_t tail_[orders];
+	int count_[orders];
+};
+
+#endif // BUDDY_HPP
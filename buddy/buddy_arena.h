@@ -0,0 +1,127 @@
+#ifndef BUDDY_ARENA_H
+#define BUDDY_ARENA_H
+
+/*
+ * Buddy arenas.
+ *
+ * An arena is one independent buddy heap of 1 << MAX_ORDER bytes: the free
+ * lists, the per-order free counters and the page descriptors, over memory
+ * the caller provides.  The buddy.h API runs on a default arena over
+ * g_memory, both lazily mmapped by the first buddy_init (map_lazy in
+ * buddy.c); layers such as buddy_numa.h keep several arenas over memory
+ * they map themselves.
+ *
+ * Arenas do no locking.  Callers sharing one between threads serialize
+ * calls on it themselves.
+ */
+
+#include "buddy.h"
+#include "list.h"
+
+#define BUDDY_PAGE_SIZE ((size_t)1<<MIN_ORDER)			// Bytes per page
+#define BUDDY_ARENA_BYTES ((size_t)1<<MAX_ORDER)		// Bytes per arena
+#define BUDDY_ARENA_PAGES (BUDDY_ARENA_BYTES / BUDDY_PAGE_SIZE)	// Pages per arena
+
+/**
+ * @type block_t
+ *
+ * @details The block type represents one or more pages in a compact format.
+ * It makes use of the Linux kernel linked list, so it includes the list_head
+ * type as a handle into that system.
+ */
+typedef struct {
+
+
+	/* Usage notes
+	 *
+	 * Every list member has a member called list_head, because the Linux
+	 * kernel uses a circular linked list scheme.
+	 *
+	 * list_head is used internally, and we need only to include it in our
+	 * struct and initialize it to be able to use a linked list.
+	 *
+	 * When an individual element is initialized, its next and previous
+	 * pointer are set to itself.
+	 */
+	struct list_head list;
+
+	// The address where this page begins
+	char* address;
+
+	// The power of 2 representing the number of bytes in this block
+	int order;
+
+	// Is this page free
+	int isFree;
+
+	// BLOCK_* flags, set when the block is allocated
+	int flags;
+
+} block_t;
+
+#define BLOCK_MOVABLE 1		// Allocated with buddy_alloc_movable
+#define BLOCK_ISOLATED 2	// Held out of the free lists by compaction
+
+/**
+ * @type buddy_arena_t
+ *
+ * @details One buddy heap.  Allocated blocks stay on the list of their
+ * order, marked not free.
+ */
+typedef struct buddy_arena_t {
+	/* free lists, store structs representing pages in blocks of various orders */
+	struct list_head free_area[MAX_ORDER+1];
+
+	/*
+	 * number of blocks with isFree set on each free_area list, kept up to
+	 * date by every split, merge, alloc and free so that counting is O(1)
+	 */
+	int free_count[MAX_ORDER+1];
+
+	/* memory the arena hands out, BUDDY_ARENA_BYTES long */
+	char *memory;
+
+	/* moves movable blocks for compaction, NULL if nothing is movable */
+	buddy_relocate_fn relocate;
+	void *relocate_arg;
+
+	/* block structures, one per page */
+	block_t pages[BUDDY_ARENA_PAGES];
+} buddy_arena_t;
+
+// Set up an arena over BUDDY_ARENA_BYTES of memory, all of it free
+void buddy_arena_init(buddy_arena_t *a, char *memory);
+
+// buddy_alloc and buddy_free on an arena
+void *buddy_arena_alloc(buddy_arena_t *a, size_t size);
+void buddy_arena_free(buddy_arena_t *a, void *addr);
+
+// Blocks and ranges at fixed offsets, see buddy_arena_alloc_at in buddy.c
+void *buddy_arena_alloc_at(buddy_arena_t *a, size_t offset, size_t size);
+int buddy_arena_reserve(buddy_arena_t *a, size_t offset, size_t size);
+void buddy_arena_unreserve(buddy_arena_t *a, size_t offset, size_t size);
+
+// Movable blocks and compaction, see buddy_arena_compact in buddy.c
+void *buddy_arena_alloc_movable(buddy_arena_t *a, size_t size);
+void buddy_arena_set_relocate(buddy_arena_t *a, buddy_relocate_fn fn, void *arg);
+int buddy_arena_compact(buddy_arena_t *a, int order, long budget_ns);
+
+// Nonzero if addr lies in the arena's memory
+static inline int buddy_arena_contains(const buddy_arena_t *a, const void *addr)
+{
+	return (const char *)addr >= a->memory &&
+	       (const char *)addr < a->memory + BUDDY_ARENA_BYTES;
+}
+
+// Order of the allocated block starting at addr
+static inline int buddy_arena_order_of(const buddy_arena_t *a, const void *addr)
+{
+	return a->pages[((const char *)addr - a->memory) / BUDDY_PAGE_SIZE].order;
+}
+
+// buddy_check, buddy_free_count and buddy_free_offsets on an arena
+int buddy_arena_check(buddy_arena_t *a);
+int buddy_arena_free_count(const buddy_arena_t *a, int order);
+int buddy_arena_free_offsets(const buddy_arena_t *a, int order, size_t *offsets, int max);
+
+#endif // BUDDY_ARENA_H
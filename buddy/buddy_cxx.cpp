@@ -0,0 +1,154 @@
+/**
+ * The buddy.h API on BuddyAllocator
+ *
+ * The heap of the buddy.h API as one BuddyAllocator<MIN_ORDER, MAX_ORDER>,
+ * built with buddy.c compiled with BUDDY_CXX_HEAP, which then leaves out its
+ * default arena and keeps the arenas the NUMA and malloc layers need along
+ * with the dumps.  The same calls give the same blocks as the default
+ * arena.  Latency histograms, tracing and heap checking are buddy.c
+ * features and are not compiled in here.  Blocks are never moved, so
+ * buddy_compact has nothing to do and movable blocks are ordinary ones.
+ *
+ * The BUDDY_CXX option builds the libraries this way; otherwise the
+ * _cxx tests link it against the same suite as buddy.c.
+ */
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include <sys/mman.h>
+
+#include "buddy.hpp"
+
+extern "C" {
+#include "buddy.h"
+#include "buddy_numa.h"
+}
+
+/**************************************************************************
+ * Global Variables
+ **************************************************************************/
+
+using Heap = BuddyAllocator<MIN_ORDER, MAX_ORDER>;
+
+static_assert(Heap::order_for(1) == MIN_ORDER, "small sizes take a page");
+static_assert(Heap::order_for(Heap::page_size + 1) == MIN_ORDER + 1, "sizes round up");
+static_assert(Heap::order_for(Heap::arena_bytes) == MAX_ORDER, "the arena is one block");
+static_assert(Heap::order_for(Heap::arena_bytes + 1) == MAX_ORDER + 1, "too big fails");
+static_assert(Heap::block_size(MIN_ORDER) == Heap::page_size, "the smallest block is a page");
+static_assert(Heap::block_size(MAX_ORDER) == Heap::arena_bytes, "the largest is the arena");
+
+// Mapped by the first buddy_init, like the heap of buddy.c, as large
+// arenas do not fit in static storage
+static Heap *heap;
+
+// Only recorded, so buddy_compact fails without one as in buddy.c
+static buddy_relocate_fn relocate;
+
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+extern "C" {
+
+void buddy_init()
+{
+	if (heap != nullptr) {
+		heap->init();
+		return;
+	}
+
+	void *p = mmap(nullptr, sizeof(Heap), PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "buddy: cannot map %zu bytes for the heap\n", sizeof(Heap));
+		abort();
+	}
+	heap = new (p) Heap;
+}
+
+
+// Routed to the node arenas once buddy_numa_init has run, as in buddy.c
+void *buddy_alloc(size_t size)
+{
+	if (buddy_numa_nodes() > 0)
+		return buddy_numa_alloc(size);
+	return heap->allocate(size);
+}
+
+
+void *buddy_alloc_movable(size_t size)
+{
+	return buddy_alloc(size);
+}
+
+
+void *buddy_alloc_at(size_t offset, size_t size)
+{
+	return heap->allocate_at(offset, size);
+}
+
+
+void buddy_free(void *addr)
+{
+	if (buddy_numa_nodes() > 0 && buddy_numa_node_of(addr) >= 0) {
+		buddy_numa_free(addr);
+		return;
+	}
+	heap->deallocate(addr);
+}
+
+
+int buddy_reserve(size_t offset, size_t size)
+{
+	return heap->reserve(offset, size) ? 0 : -1;
+}
+
+
+void buddy_unreserve(size_t offset, size_t size)
+{
+	heap->unreserve(offset, size);
+}
+
+
+void buddy_set_relocate(buddy_relocate_fn fn, void *)
+{
+	relocate = fn;
+}
+
+
+int buddy_compact(int order, long)
+{
+	if (order < MIN_ORDER || order > MAX_ORDER || relocate == nullptr)
+		return -1;
+	for (int o = order; o <= MAX_ORDER; o++) {
+		if (heap->free_count(o) > 0)
+			return 1;
+	}
+	return -1;
+}
+
+
+int buddy_check()
+{
+	return heap->check();
+}
+
+
+int buddy_free_count(int order)
+{
+	return order < 0 ? 0 : heap->free_count(order);
+}
+
+
+int buddy_free_offsets(int order, size_t *offsets, int max)
+{
+	return order < 0 ? 0 : heap->free_offsets(order, offsets, max);
+}
+
+} // extern "C"
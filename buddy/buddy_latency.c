@@ -0,0 +1,217 @@
+/**
+ * Latency histograms for buddy_alloc and buddy_free
+ *
+ * See buddy_latency.h for the bucket layout.
+ */
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "buddy_latency.h"
+
+/**************************************************************************
+ * Global Variables
+ **************************************************************************/
+
+/* one histogram per operation and order, orders below MIN_ORDER unused */
+static uint64_t g_hist[LAT_NUM_OPS][LAT_ORDER_INVALID + 1][LAT_BUCKETS];
+
+
+/**************************************************************************
+ * Local Functions
+ **************************************************************************/
+
+/**
+ * @brief Map a value to its bucket.
+ */
+static inline int bucket_of(uint64_t v)
+{
+	if (v < LAT_LINEAR) {
+		return (int)v;
+	}
+
+	int e = 63 - __builtin_clzll(v);
+	return LAT_LINEAR + (e - LAT_SUB_BITS - 1) * LAT_SUB_BUCKETS
+		+ (int)((v >> (e - LAT_SUB_BITS)) & (LAT_SUB_BUCKETS - 1));
+}
+
+
+/**
+ * @brief Sum the buckets of one operation over one order or all of them.
+ */
+static void collect(lat_op_t op, int order, uint64_t *out)
+{
+	int o, b;
+
+	memset(out, 0, LAT_BUCKETS * sizeof(uint64_t));
+	for (o = MIN_ORDER; o <= LAT_ORDER_INVALID; o++) {
+		if (order != LAT_ALL_ORDERS && order != o) {
+			continue;
+		}
+		for (b = 0; b < LAT_BUCKETS; b++) {
+			out[b] += g_hist[op][o][b];
+		}
+	}
+}
+
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+/**
+ * @brief Add one sample.  Orders outside the allocator's range are counted
+ * 		under LAT_ORDER_INVALID.
+ */
+void buddy_latency_record(lat_op_t op, int order, uint64_t cycles)
+{
+	if (order < MIN_ORDER || order > MAX_ORDER) {
+		order = LAT_ORDER_INVALID;
+	}
+	g_hist[op][order][bucket_of(cycles)]++;
+}
+
+
+/**
+ * @brief Clear all histograms.
+ */
+void buddy_latency_reset()
+{
+	memset(g_hist, 0, sizeof(g_hist));
+}
+
+
+/**
+ * @brief Upper bound of the values counted in a bucket.
+ */
+uint64_t buddy_latency_bucket_limit(int bucket)
+{
+	if (bucket < LAT_LINEAR) {
+		return (uint64_t)bucket;
+	}
+
+	int k = bucket - LAT_LINEAR;
+	int e = k / LAT_SUB_BUCKETS + LAT_SUB_BITS + 1;
+	uint64_t step = 1ull << (e - LAT_SUB_BITS);
+	uint64_t lower = (1ull << e) + (uint64_t)(k % LAT_SUB_BUCKETS) * step;
+
+	return lower + (step - 1);
+}
+
+
+/**
+ * @brief Copy out the raw buckets of one operation and order.
+ */
+void buddy_latency_buckets(lat_op_t op, int order, uint64_t *buckets)
+{
+	collect(op, order, buckets);
+}
+
+
+/**
+ * @brief Number of samples recorded for an operation and order.
+ */
+uint64_t buddy_latency_count(lat_op_t op, int order)
+{
+	uint64_t buckets[LAT_BUCKETS];
+	uint64_t total = 0;
+	int b;
+
+	collect(op, order, buckets);
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		total += buckets[b];
+	}
+	return total;
+}
+
+
+/**
+ * @brief Value at the given percentile (0-100) of an operation and order.
+ */
+uint64_t buddy_latency_percentile(lat_op_t op, int order, double pct)
+{
+	uint64_t buckets[LAT_BUCKETS];
+	uint64_t total = 0;
+	uint64_t seen = 0;
+	uint64_t rank;
+	int b;
+
+	collect(op, order, buckets);
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		total += buckets[b];
+	}
+	if (0 == total) {
+		return 0;
+	}
+
+	// Rank of the sample we want, 1 based
+	rank = (uint64_t)(pct / 100.0 * (double)total + 0.5);
+	if (rank < 1) {
+		rank = 1;
+	}
+	if (rank > total) {
+		rank = total;
+	}
+
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		seen += buckets[b];
+		if (seen >= rank) {
+			return buddy_latency_bucket_limit(b);
+		}
+	}
+	return buddy_latency_bucket_limit(LAT_BUCKETS - 1);
+}
+
+
+/**
+ * @brief Print count and percentiles for each populated op and order.
+ */
+void buddy_latency_print(FILE *out)
+{
+	static const char *op_names[LAT_NUM_OPS] = { "alloc", "free" };
+	static const double pcts[] = { 50.0, 90.0, 99.0, 99.9, 100.0 };
+	int op, o;
+	unsigned i;
+
+	if (!buddy_latency_enabled()) {
+		fprintf(out, "Latency instrumentation was not compiled in (USE_LATENCY)\n");
+		return;
+	}
+
+	fprintf(out, "%-6s %6s %10s %10s %10s %10s %10s %10s\n",
+		"op", "order", "count", "p50", "p90", "p99", "p99.9", "max");
+
+	for (op = 0; op < LAT_NUM_OPS; op++) {
+		for (o = MIN_ORDER; o <= LAT_ORDER_INVALID + 1; o++) {
+			// One row past the last order prints the total
+			int order = o > LAT_ORDER_INVALID ? LAT_ALL_ORDERS : o;
+			uint64_t count = buddy_latency_count(op, order);
+
+			if (0 == count) {
+				continue;
+			}
+
+			if (LAT_ALL_ORDERS == order) {
+				fprintf(out, "%-6s %6s %10llu", op_names[op], "all",
+					(unsigned long long)count);
+			}
+			else if (LAT_ORDER_INVALID == order) {
+				fprintf(out, "%-6s %6s %10llu", op_names[op], "bad",
+					(unsigned long long)count);
+			}
+			else {
+				fprintf(out, "%-6s %6d %10llu", op_names[op], order,
+					(unsigned long long)count);
+			}
+
+			for (i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++) {
+				fprintf(out, " %10llu", (unsigned long long)
+					buddy_latency_percentile(op, order, pcts[i]));
+			}
+			fprintf(out, "\n");
+		}
+	}
+}
@@ -0,0 +1,67 @@
+#ifndef BUDDY_LATENCY_H
+#define BUDDY_LATENCY_H
+
+/*
+ * Latency histograms for buddy_alloc and buddy_free.
+ *
+ * When buddy.c is built with USE_LATENCY set, every call records its cost in
+ * read_cycles() units into a log-scale histogram for its operation and block
+ * order.  Buckets follow the HDR layout: values below LAT_LINEAR each get a
+ * bucket, above that every power of two is split into LAT_SUB_BUCKETS linear
+ * steps, so any recorded value is known to within 1/LAT_SUB_BUCKETS.
+ *
+ * The histograms are plain counters and share the allocator's (lack of)
+ * locking.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "buddy.h"
+
+/**
+ * Instrumented operations
+ */
+typedef enum lat_op_t {
+	LAT_ALLOC = 0,
+	LAT_FREE,
+	LAT_NUM_OPS
+} lat_op_t;
+
+#define LAT_SUB_BITS 3
+#define LAT_SUB_BUCKETS (1 << LAT_SUB_BITS)
+#define LAT_LINEAR (2 * LAT_SUB_BUCKETS)
+#define LAT_BUCKETS (LAT_LINEAR + (64 - LAT_SUB_BITS - 1) * LAT_SUB_BUCKETS)
+
+/* Order slot used for requests that could not be mapped to an order */
+#define LAT_ORDER_INVALID (MAX_ORDER + 1)
+
+/* Pass as the order to a query to aggregate over every order */
+#define LAT_ALL_ORDERS (-1)
+
+// Nonzero if buddy.c was built with the instrumentation hooks
+int buddy_latency_enabled();
+
+// Add one sample to the histogram of the given operation and order
+void buddy_latency_record(lat_op_t op, int order, uint64_t cycles);
+
+// Clear all histograms
+void buddy_latency_reset();
+
+// Number of samples for an operation and order (or LAT_ALL_ORDERS)
+uint64_t buddy_latency_count(lat_op_t op, int order);
+
+// Smallest recorded value v such that pct percent of samples are <= v,
+// rounded up to its bucket's upper bound.  Zero when there are no samples.
+uint64_t buddy_latency_percentile(lat_op_t op, int order, double pct);
+
+// Copy out the raw bucket counts, buckets must hold LAT_BUCKETS entries
+void buddy_latency_buckets(lat_op_t op, int order, uint64_t *buckets);
+
+// Upper bound of the values counted in a bucket
+uint64_t buddy_latency_bucket_limit(int bucket);
+
+// Print a percentile table for every populated operation and order
+void buddy_latency_print(FILE *out);
+
+#endif // BUDDY_LATENCY_H
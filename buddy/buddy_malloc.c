@@ -0,0 +1,463 @@
+/**
+ * malloc interposition over buddy arenas
+ *
+ * Built as libbuddymalloc.so, this file exports the malloc family so that
+ * LD_PRELOAD runs an unmodified program on the buddy allocator:
+ *
+ *   - Requests up to SMALL_MAX bytes go to power-of-two size classes from
+ *     16 bytes up.  A class takes whole pages from the buddy arenas and
+ *     carves them into objects; freed objects go on the class's free list
+ *     and the pages stay with the class.
+ *
+ *   - Larger requests up to an arena are buddy blocks.  Every arena sits in
+ *     one region of address space reserved on the first call and aligned to
+ *     the arena size, so a block of order o is aligned to 1 << o and the
+ *     arena that owns a pointer is found by a shift.  Arenas and their page
+ *     class maps are mapped as the heap grows.
+ *
+ *   - Anything bigger, or anything once the region is full, is mapped on
+ *     its own with a header just below the returned pointer.
+ *
+ * Nothing here calls into libc's allocator, and setup needs only mmap and a
+ * statically initialized mutex, so the first call can come from the dynamic
+ * loader or a constructor before main.  One lock covers the whole heap.
+ */
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "buddy_arena.h"
+
+/**************************************************************************
+ * Private Definitions
+ **************************************************************************/
+
+#define EXPORT __attribute__((visibility("default")))
+
+#define MALLOC_ARENAS 1024		// Region size in arenas, 1 GiB with 1 MB arenas
+#define MIN_CLASS_SHIFT 4		// Smallest size class, 16 bytes
+#define SMALL_MAX 2048			// Largest size class
+#define N_CLASSES 8			// 16, 32, ... SMALL_MAX
+
+#define LARGE_MAGIC 0x6275646479626967ul	// "buddybig"
+
+/**
+ * @type heap_t
+ *
+ * @details One arena and the size class of each of its pages, 0 for pages
+ * that are buddy blocks or parts of them.
+ */
+typedef struct heap_t {
+	buddy_arena_t arena;
+	unsigned char page_class[BUDDY_ARENA_PAGES];
+} heap_t;
+
+/**
+ * @type large_t
+ *
+ * @details Header stored just below a pointer from a separate mapping.
+ */
+typedef struct large_t {
+	void *base;			// Start of the mapping
+	size_t len;			// Length of the mapping
+	size_t size;			// Usable bytes from the returned pointer
+	unsigned long magic;
+} large_t;
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static int initialized;
+
+static char *region;			// Arena memory, n_slots arenas long
+static int n_slots;			// Arenas the region has room for
+static int n_heaps;			// Arenas mapped so far
+static int last_heap;			// Arena that last served a block
+static heap_t *heaps[MALLOC_ARENAS];
+
+static void *class_free[N_CLASSES];	// Free objects per size class
+
+
+/**************************************************************************
+ * Local Functions
+ **************************************************************************/
+
+static void prefork(void)
+{
+	pthread_mutex_lock(&heap_lock);
+}
+
+static void postfork_parent(void)
+{
+	pthread_mutex_unlock(&heap_lock);
+}
+
+static void postfork_child(void)
+{
+	pthread_mutex_init(&heap_lock, NULL);
+}
+
+
+/**
+ * @brief Reserve the arena region. Called with heap_lock held.
+ *
+ * The reservation shrinks by halves until the kernel accepts it, so strict
+ * overcommit settings only cost capacity.
+ */
+static void reserve_region(void)
+{
+	size_t len;
+	char *p;
+
+	for (n_slots = MALLOC_ARENAS; n_slots > 0; n_slots /= 2) {
+		// One arena extra, to align the start to the arena size
+		len = (size_t)(n_slots + 1) * BUDDY_ARENA_BYTES;
+		p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (p != MAP_FAILED)
+			break;
+	}
+	if (n_slots == 0)
+		return;
+
+	region = (char *)(((uintptr_t)p + BUDDY_ARENA_BYTES - 1) & ~(uintptr_t)(BUDDY_ARENA_BYTES - 1));
+	if (region > p)
+		munmap(p, region - p);
+	munmap(region + (size_t)n_slots * BUDDY_ARENA_BYTES,
+	       p + len - (region + (size_t)n_slots * BUDDY_ARENA_BYTES));
+}
+
+
+/**
+ * @brief Set up on the first call into the allocator.
+ */
+static void malloc_init(void)
+{
+	int first = 0;
+
+	pthread_mutex_lock(&heap_lock);
+	if (!initialized) {
+		reserve_region();
+		initialized = first = 1;
+	}
+	pthread_mutex_unlock(&heap_lock);
+
+	// May allocate, so only once the heap is usable and the lock is free
+	if (first)
+		pthread_atfork(prefork, postfork_parent, postfork_child);
+}
+
+
+/**
+ * @brief Arena holding p, or NULL if p is not in the region.
+ */
+static heap_t *heap_of(const void *p)
+{
+	if (region == NULL || (const char *)p < region ||
+	    (const char *)p >= region + (size_t)n_slots * BUDDY_ARENA_BYTES)
+		return NULL;
+	return heaps[((const char *)p - region) / BUDDY_ARENA_BYTES];
+}
+
+
+/**
+ * @brief Take a buddy block, mapping another arena if every one is full.
+ * Called with heap_lock held.
+ */
+static void *heap_alloc(size_t size)
+{
+	heap_t *h;
+	void *p;
+	int i;
+
+	for (i = 0; i < n_heaps; i++) {
+		int k = (last_heap + i) % n_heaps;
+
+		p = buddy_arena_alloc(&heaps[k]->arena, size);
+		if (p != NULL) {
+			last_heap = k;
+			return p;
+		}
+	}
+
+	if (n_heaps == n_slots)
+		return NULL;
+
+	h = mmap(NULL, sizeof(heap_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (h == MAP_FAILED)
+		return NULL;
+	buddy_arena_init(&h->arena, region + (size_t)n_heaps * BUDDY_ARENA_BYTES);
+	last_heap = n_heaps;
+	heaps[n_heaps++] = h;
+
+	return buddy_arena_alloc(&h->arena, size);
+}
+
+
+/**
+ * @brief Size class serving size bytes.
+ */
+static int class_of(size_t size)
+{
+	int c = 0;
+
+	while (((size_t)1 << (c + MIN_CLASS_SHIFT)) < size)
+		c++;
+	return c;
+}
+
+
+/**
+ * @brief Pop an object of class c, carving a new page if the list is empty.
+ * Called with heap_lock held.
+ */
+static void *class_alloc(int c)
+{
+	size_t obj = (size_t)1 << (c + MIN_CLASS_SHIFT);
+	char *page, *p;
+
+	if (class_free[c] == NULL) {
+		page = heap_alloc(BUDDY_PAGE_SIZE);
+		if (page == NULL)
+			return NULL;
+		heap_of(page)->page_class[(page - heap_of(page)->arena.memory) / BUDDY_PAGE_SIZE] = c + 1;
+
+		// Thread the page's objects onto the list in address order
+		for (p = page + BUDDY_PAGE_SIZE - obj; p >= page; p -= obj) {
+			*(void **)p = class_free[c];
+			class_free[c] = p;
+		}
+	}
+
+	p = class_free[c];
+	class_free[c] = *(void **)p;
+	return p;
+}
+
+
+/**
+ * @brief Map a block of its own, aligned to align bytes.
+ */
+static void *large_alloc(size_t size, size_t align)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t pad = align > page ? align : page;
+	size_t len;
+	char *base, *p;
+	large_t *hdr;
+
+	if (size > SIZE_MAX - 2 * pad)
+		return NULL;
+	len = (size + 2 * pad + page - 1) & ~(page - 1);
+
+	base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	p = (char *)(((uintptr_t)base + sizeof(large_t) + pad - 1) & ~(uintptr_t)(pad - 1));
+	hdr = (large_t *)p - 1;
+	hdr->base = base;
+	hdr->len = len;
+	hdr->size = base + len - p;
+	hdr->magic = LARGE_MAGIC;
+	return p;
+}
+
+
+/**
+ * @brief Header of a separately mapped block, or NULL if p is not one.
+ */
+static large_t *large_of(void *p)
+{
+	large_t *hdr = (large_t *)p - 1;
+
+	if (((uintptr_t)p & 15) != 0 || hdr->magic != LARGE_MAGIC)
+		return NULL;
+	return hdr;
+}
+
+
+/**
+ * @brief Allocate size bytes aligned to align, a power of two.
+ */
+static void *alloc_aligned(size_t size, size_t align)
+{
+	size_t need = size > align ? size : align;
+	void *p = NULL;
+
+	if (!initialized)
+		malloc_init();
+
+	if (need == 0)
+		need = 1;
+
+	if (need <= BUDDY_ARENA_BYTES) {
+		pthread_mutex_lock(&heap_lock);
+		if (need <= SMALL_MAX)
+			p = class_alloc(class_of(need));
+		else
+			p = heap_alloc(need);
+		pthread_mutex_unlock(&heap_lock);
+	}
+
+	if (p == NULL)
+		p = large_alloc(size, align);
+	if (p == NULL)
+		errno = ENOMEM;
+	return p;
+}
+
+
+/**
+ * @brief Bytes usable at p, which must be a live allocation.
+ */
+static size_t usable_size(void *p)
+{
+	heap_t *h = heap_of(p);
+	large_t *hdr;
+	int c;
+
+	if (h == NULL) {
+		hdr = large_of(p);
+		return hdr ? hdr->size : 0;
+	}
+
+	c = h->page_class[((char *)p - h->arena.memory) / BUDDY_PAGE_SIZE];
+	if (c != 0)
+		return (size_t)1 << (c - 1 + MIN_CLASS_SHIFT);
+	return (size_t)1 << buddy_arena_order_of(&h->arena, p);
+}
+
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+EXPORT void *malloc(size_t size)
+{
+	return alloc_aligned(size, 16);
+}
+
+
+EXPORT void free(void *p)
+{
+	heap_t *h;
+	large_t *hdr;
+	int c;
+
+	if (p == NULL)
+		return;
+
+	h = heap_of(p);
+	if (h == NULL) {
+		// Not ours at all is left alone rather than crashing the program
+		hdr = large_of(p);
+		if (hdr != NULL) {
+			hdr->magic = 0;
+			munmap(hdr->base, hdr->len);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&heap_lock);
+	c = h->page_class[((char *)p - h->arena.memory) / BUDDY_PAGE_SIZE];
+	if (c != 0) {
+		*(void **)p = class_free[c - 1];
+		class_free[c - 1] = p;
+	} else {
+		buddy_arena_free(&h->arena, p);
+	}
+	pthread_mutex_unlock(&heap_lock);
+}
+
+
+EXPORT void *calloc(size_t n, size_t size)
+{
+	void *p;
+
+	if (size != 0 && n > SIZE_MAX / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	// Not malloc, which GCC would fold with the memset into a call to calloc
+	p = alloc_aligned(n * size, 16);
+	// Separate mappings come zeroed from the kernel
+	if (p != NULL && heap_of(p) != NULL)
+		memset(p, 0, n * size);
+	return p;
+}
+
+
+EXPORT void *realloc(void *p, size_t size)
+{
+	size_t old;
+	void *q;
+
+	if (p == NULL)
+		return malloc(size);
+	if (size == 0) {
+		free(p);
+		return NULL;
+	}
+
+	old = usable_size(p);
+	if (size <= old)
+		return p;
+
+	q = malloc(size);
+	if (q == NULL)
+		return NULL;
+	memcpy(q, p, old);
+	free(p);
+	return q;
+}
+
+
+EXPORT int posix_memalign(void **out, size_t align, size_t size)
+{
+	void *p;
+
+	if (align < sizeof(void *) || (align & (align - 1)) != 0)
+		return EINVAL;
+
+	p = alloc_aligned(size, align < 16 ? 16 : align);
+	if (p == NULL)
+		return ENOMEM;
+	*out = p;
+	return 0;
+}
+
+
+EXPORT void *aligned_alloc(size_t align, size_t size)
+{
+	if (align == 0 || (align & (align - 1)) != 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return alloc_aligned(size, align < 16 ? 16 : align);
+}
+
+
+EXPORT void *memalign(size_t align, size_t size)
+{
+	return aligned_alloc(align, size);
+}
+
+
+EXPORT void *valloc(size_t size)
+{
+	return alloc_aligned(size, sysconf(_SC_PAGESIZE));
+}
+
+
+EXPORT size_t malloc_usable_size(void *p)
+{
+	return p ? usable_size(p) : 0;
+}
@@ -0,0 +1,384 @@
+/**
+ * NUMA-aware allocation over one buddy arena per node
+ *
+ * See buddy_numa.h for an overview.
+ */
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#define _GNU_SOURCE		// sched_getcpu
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "buddy_arena.h"
+#include "buddy_numa.h"
+
+/**************************************************************************
+ * Private Definitions
+ **************************************************************************/
+
+#define MPOL_BIND 2		// From linux/mempolicy.h, so libnuma is not needed
+#define MAX_CPUS 4096
+
+#define NODE_DIR "/sys/devices/system/node"
+
+/**
+ * @type node_t
+ *
+ * @details One node's arena, its lock and its counters.
+ */
+typedef struct node_t {
+	int sys_id;			// Node id the kernel uses
+	buddy_arena_t *arena;		// Descriptors, mapped on the node
+	char *memory;			// Memory the arena hands out
+	pthread_mutex_t lock;
+	buddy_numa_stats_t stats;
+} node_t;
+
+static node_t nodes[BUDDY_NUMA_MAX_NODES];
+static int n_nodes;
+static int fake_nodes;				// BUDDY_FAKE_NUMA, 0 if unset
+static short cpu_node[MAX_CPUS];		// Dense node index of each CPU
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**************************************************************************
+ * Local Functions
+ **************************************************************************/
+
+/**
+ * @brief Expand a kernel list such as "0-3,8,10-11", skipping ids from
+ *		limit up.
+ *
+ * @return number of entries stored in out
+ */
+static int parse_list(const char *s, int *out, int max, long limit)
+{
+	int n = 0;
+
+	while (*s) {
+		char *end;
+		long lo = strtol(s, &end, 10), hi = lo;
+
+		if (end == s)
+			break;
+		if (*end == '-')
+			hi = strtol(end + 1, &end, 10);
+		if (hi >= limit)
+			hi = limit - 1;
+		for (; lo <= hi && n < max; lo++)
+			out[n++] = (int)lo;
+		s = *end == ',' ? end + 1 : end;
+	}
+	return n;
+}
+
+
+/**
+ * @brief Read the first line of a sysfs file.
+ *
+ * @return 0 on success, -1 if it cannot be read
+ */
+static int read_line(const char *path, char *buf, int len)
+{
+	FILE *f = fopen(path, "r");
+	int ok;
+
+	if (f == NULL)
+		return -1;
+	ok = fgets(buf, len, f) != NULL;
+	fclose(f);
+	if (!ok)
+		return -1;
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
+
+
+/**
+ * @brief Fill in node ids and the CPU to node map.
+ */
+static void discover_topology(void)
+{
+	static int ids[BUDDY_NUMA_MAX_NODES];
+	static int cpus[MAX_CPUS];
+	const char *fake = getenv("BUDDY_FAKE_NUMA");
+	char buf[4096], path[128];
+	int i, j, n;
+
+	memset(cpu_node, 0, sizeof(cpu_node));
+
+	if (fake != NULL && atoi(fake) > 0) {
+		fake_nodes = atoi(fake) < BUDDY_NUMA_MAX_NODES ? atoi(fake) : BUDDY_NUMA_MAX_NODES;
+		n_nodes = fake_nodes;
+		for (i = 0; i < n_nodes; i++)
+			nodes[i].sys_id = i;
+		for (i = 0; i < MAX_CPUS; i++)
+			cpu_node[i] = i % n_nodes;
+		return;
+	}
+
+	// Without sysfs, treat the machine as one node.  Node ids past the
+	// bind mask are left out.
+	if (read_line(NODE_DIR "/online", buf, sizeof(buf)) != 0 ||
+	    (n = parse_list(buf, ids, BUDDY_NUMA_MAX_NODES, BUDDY_NUMA_MAX_NODES)) == 0) {
+		ids[0] = 0;
+		n = 1;
+	}
+
+	n_nodes = n;
+	for (i = 0; i < n; i++) {
+		nodes[i].sys_id = ids[i];
+		snprintf(path, sizeof(path), NODE_DIR "/node%d/cpulist", ids[i]);
+		if (read_line(path, buf, sizeof(buf)) != 0)
+			continue;
+		int nc = parse_list(buf, cpus, MAX_CPUS, MAX_CPUS);
+		for (j = 0; j < nc; j++)
+			cpu_node[cpus[j]] = i;
+	}
+}
+
+
+/**
+ * @brief Bind a mapping to one node.
+ *
+ * @return 0 on success, -1 if the kernel refused
+ */
+static int bind_to_node(void *addr, size_t len, int sys_id)
+{
+	unsigned long mask[BUDDY_NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+
+	memset(mask, 0, sizeof(mask));
+	mask[sys_id / (8 * sizeof(unsigned long))] |= 1ul << (sys_id % (8 * sizeof(unsigned long)));
+
+	return syscall(SYS_mbind, addr, len, MPOL_BIND, mask, sizeof(mask) * 8 + 1, 0) == 0 ? 0 : -1;
+}
+
+
+/**
+ * @brief Map one anonymous region, bound to a node unless faking.
+ *
+ * @return the mapping, or NULL
+ */
+static void *map_on_node(size_t len, node_t *node)
+{
+	void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	if (p == MAP_FAILED)
+		return NULL;
+	if (!fake_nodes && bind_to_node(p, len, node->sys_id) != 0)
+		node->stats.bound = 0;
+	return p;
+}
+
+
+/**
+ * @brief Try one node's arena, counting the block as local if the caller
+ *		runs on that node.
+ */
+static void *alloc_from(node_t *node, size_t size, int local)
+{
+	void *p;
+
+	pthread_mutex_lock(&node->lock);
+	p = buddy_arena_alloc(node->arena, size);
+	if (p != NULL) {
+		node->stats.allocs++;
+		node->stats.local += local;
+	}
+	pthread_mutex_unlock(&node->lock);
+	return p;
+}
+
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+/**
+ * @brief Map, bind and initialize an arena per node.
+ */
+int buddy_numa_init(void)
+{
+	int i, ready = 0;
+
+	pthread_mutex_lock(&init_lock);
+	if (n_nodes > 0) {
+		pthread_mutex_unlock(&init_lock);
+		return n_nodes;
+	}
+
+	discover_topology();
+
+	for (i = 0; i < n_nodes; i++) {
+		node_t *node = &nodes[i];
+
+		pthread_mutex_init(&node->lock, NULL);
+		memset(&node->stats, 0, sizeof(node->stats));
+		node->stats.bound = !fake_nodes;
+
+		// Bind before buddy_arena_init first touches either mapping
+		node->arena = map_on_node(sizeof(buddy_arena_t), node);
+		node->memory = map_on_node(BUDDY_ARENA_BYTES, node);
+		if (node->arena == NULL || node->memory == NULL) {
+			fprintf(stderr, "buddy: no arena for node %d\n", node->sys_id);
+			if (node->arena != NULL)
+				munmap(node->arena, sizeof(buddy_arena_t));
+			if (node->memory != NULL)
+				munmap(node->memory, BUDDY_ARENA_BYTES);
+			node->arena = NULL;
+			node->memory = NULL;
+			continue;
+		}
+		buddy_arena_init(node->arena, node->memory);
+		ready++;
+	}
+
+	if (ready == 0)
+		n_nodes = 0;
+	pthread_mutex_unlock(&init_lock);
+
+	return ready ? n_nodes : -1;
+}
+
+
+/**
+ * @brief Number of nodes.
+ */
+int buddy_numa_nodes(void)
+{
+	return n_nodes;
+}
+
+
+/**
+ * @brief Node of the CPU the caller is running on.
+ */
+int buddy_numa_current_node(void)
+{
+	int cpu = sched_getcpu();
+
+	if (cpu < 0 || cpu >= MAX_CPUS)
+		return 0;
+	return cpu_node[cpu];
+}
+
+
+/**
+ * @brief Allocate on the given node, then on the nodes after it in turn.
+ */
+void *buddy_numa_alloc_onnode(size_t size, int node)
+{
+	int i, here;
+
+	if (node < 0 || node >= n_nodes)
+		return NULL;
+
+	here = buddy_numa_current_node();
+	for (i = 0; i < n_nodes; i++) {
+		int k = (node + i) % n_nodes;
+		node_t *n = &nodes[k];
+		void *p;
+
+		if (n->arena == NULL)
+			continue;
+		p = alloc_from(n, size, k == here);
+		if (p != NULL) {
+			if (i != 0) {
+				pthread_mutex_lock(&nodes[node].lock);
+				nodes[node].stats.remote++;
+				pthread_mutex_unlock(&nodes[node].lock);
+			}
+			return p;
+		}
+	}
+
+	pthread_mutex_lock(&nodes[node].lock);
+	nodes[node].stats.failures++;
+	pthread_mutex_unlock(&nodes[node].lock);
+	return NULL;
+}
+
+
+/**
+ * @brief Allocate on the caller's node, falling back to the others.
+ */
+void *buddy_numa_alloc(size_t size)
+{
+	return buddy_numa_alloc_onnode(size, buddy_numa_current_node());
+}
+
+
+/**
+ * @brief Node whose arena holds addr.
+ */
+int buddy_numa_node_of(const void *addr)
+{
+	int i;
+
+	for (i = 0; i < n_nodes; i++) {
+		if (nodes[i].arena != NULL && buddy_arena_contains(nodes[i].arena, addr))
+			return i;
+	}
+	return -1;
+}
+
+
+/**
+ * @brief Return a block to the arena it came from.
+ */
+void buddy_numa_free(void *addr)
+{
+	int i = buddy_numa_node_of(addr);
+
+	if (i < 0)
+		return;
+
+	pthread_mutex_lock(&nodes[i].lock);
+	buddy_arena_free(nodes[i].arena, addr);
+	nodes[i].stats.frees++;
+	pthread_mutex_unlock(&nodes[i].lock);
+}
+
+
+/**
+ * @brief Copy out one node's counters.
+ */
+int buddy_numa_get_stats(int node, buddy_numa_stats_t *stats)
+{
+	if (node < 0 || node >= n_nodes)
+		return -1;
+
+	pthread_mutex_lock(&nodes[node].lock);
+	*stats = nodes[node].stats;
+	pthread_mutex_unlock(&nodes[node].lock);
+	return 0;
+}
+
+
+/**
+ * @brief Print every node's counters.
+ */
+void buddy_numa_print_stats(FILE *out)
+{
+	int i;
+
+	fprintf(out, "%4s %6s %10s %10s %10s %10s %10s\n", "node", "bound",
+		"allocs", "local", "remote", "failures", "frees");
+	for (i = 0; i < n_nodes; i++) {
+		buddy_numa_stats_t st;
+
+		buddy_numa_get_stats(i, &st);
+		fprintf(out, "%4d %6s %10lu %10lu %10lu %10lu %10lu\n", nodes[i].sys_id,
+			st.bound ? "yes" : "no", st.allocs, st.local, st.remote,
+			st.failures, st.frees);
+	}
+}
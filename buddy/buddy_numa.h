@@ -0,0 +1,71 @@
+#ifndef BUDDY_NUMA_H
+#define BUDDY_NUMA_H
+
+/*
+ * NUMA-aware allocation over one buddy arena per node.
+ *
+ * buddy_numa_init maps an arena for every memory node and binds its memory
+ * and descriptors to that node with mbind, before anything touches them.
+ * buddy_numa_alloc serves the calling CPU's node first and falls back to the
+ * other nodes in order of node id, starting after the local one.  Each
+ * arena has its own lock, so threads on different nodes do not contend.
+ *
+ * Once buddy_numa_init has run, buddy_alloc and buddy_free go through
+ * buddy_numa_alloc and buddy_numa_free, so existing callers get node-local
+ * blocks without changes; call it before any thread allocates.  The other
+ * buddy.h calls (placement, reservation, movable blocks, compaction and the
+ * counters and dumps) keep working on the default arena.
+ *
+ * The topology comes from /sys/devices/system/node.  Setting
+ * BUDDY_FAKE_NUMA=N in the environment fakes N nodes instead, with CPU c on
+ * node c % N and no binding, so the fallback paths can be tested on a
+ * single-node machine.
+ */
+
+#include <stdio.h>
+
+#define BUDDY_NUMA_MAX_NODES 64
+
+/**
+ * @type buddy_numa_stats_t
+ *
+ * @details Counters for one node.
+ */
+typedef struct buddy_numa_stats_t {
+	unsigned long allocs;		///< Blocks handed out from this node's arena
+	unsigned long local;		///< ...of which to a thread running on this node
+	unsigned long remote;		///< Requests from this node served by another node
+	unsigned long failures;		///< Requests from this node that no node could serve
+	unsigned long frees;		///< Blocks returned to this node's arena
+	int bound;			///< Arena memory is bound to the node with mbind
+} buddy_numa_stats_t;
+
+// Map and bind one arena per node. Returns the number of nodes, or -1 if no
+// arena could be mapped. Calling it again does nothing.
+int buddy_numa_init(void);
+
+// Number of nodes set up by buddy_numa_init
+int buddy_numa_nodes(void);
+
+// Node of the CPU the caller is running on
+int buddy_numa_current_node(void);
+
+// Allocate on the caller's node, falling back to the others
+void *buddy_numa_alloc(size_t size);
+
+// Allocate on the given node, falling back to the others
+void *buddy_numa_alloc_onnode(size_t size, int node);
+
+// Free a block from any node
+void buddy_numa_free(void *addr);
+
+// Node whose arena holds addr, or -1
+int buddy_numa_node_of(const void *addr);
+
+// Copy out one node's counters. Returns -1 for an unknown node.
+int buddy_numa_get_stats(int node, buddy_numa_stats_t *stats);
+
+// Print every node's counters
+void buddy_numa_print_stats(FILE *out);
+
+#endif // BUDDY_NUMA_H
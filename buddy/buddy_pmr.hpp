@@ -0,0 +1,204 @@
+#ifndef BUDDY_PMR_HPP
+#define BUDDY_PMR_HPP
+
+/*
+ * Container storage on the buddy heap.
+ *
+ * BuddyResource is a std::pmr::memory_resource over buddy_alloc and
+ * buddy_free, and BuddyStlAllocator<T> is a standard Allocator over a
+ * BuddyResource for containers that take an allocator type rather than a
+ * resource.  Requests of more than half a page go to the buddy heap as they
+ * are.  Smaller ones would waste most of a page each, so they are rounded
+ * up to a power of two from 16 bytes and carved out of pages the resource
+ * takes from the heap, with one free list per size; a freed piece goes back
+ * on its list, and the pages themselves go back to the heap all at once
+ * when the resource is released or destroyed, together with any larger
+ * blocks still outstanding.
+ *
+ * Like the buddy.h API underneath, neither does any locking, and the heap
+ * must have been set up with buddy_init() first.  buddy_init() frees
+ * everything, so release the resources before calling it again.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+#include <unordered_set>
+#include <vector>
+
+extern "C" {
+#include "buddy.h"
+}
+
+class BuddyResource final : public std::pmr::memory_resource {
+public:
+	static constexpr std::size_t page_size = std::size_t(1) << MIN_ORDER;
+	static constexpr std::size_t min_piece = 16;
+
+	BuddyResource() = default;
+	BuddyResource(const BuddyResource &) = delete;
+	BuddyResource &operator=(const BuddyResource &) = delete;
+	~BuddyResource() override { release(); }
+
+	// The resource the default BuddyStlAllocator uses
+	static BuddyResource &shared() noexcept
+	{
+		static BuddyResource r;
+		return r;
+	}
+
+	// Give every page holding small pieces and every large block back to
+	// the heap, whether or not they have been deallocated
+	void release() noexcept
+	{
+		for (void *p : pages_)
+			buddy_free(p);
+		pages_.clear();
+		for (Piece *&f : free_)
+			f = nullptr;
+		for (void *p : large_)
+			buddy_free(p);
+		large_.clear();
+	}
+
+	// Pages currently holding small pieces
+	std::size_t pages() const noexcept { return pages_.size(); }
+
+	// Large blocks allocated and not yet deallocated
+	std::size_t blocks() const noexcept { return large_.size(); }
+
+private:
+	struct Piece {
+		Piece *next;
+	};
+
+	static constexpr unsigned min_shift = 4;
+	static constexpr unsigned n_classes = MIN_ORDER - min_shift;
+
+	// Size class of a small request, n_classes if it is not small
+	static constexpr unsigned class_of(std::size_t bytes) noexcept
+	{
+		unsigned c = 0;
+		while (c < n_classes && (min_piece << c) < bytes)
+			c++;
+		return c;
+	}
+
+	void *do_allocate(std::size_t bytes, std::size_t alignment) override
+	{
+		const std::size_t need = bytes > alignment ? bytes : alignment;
+		const unsigned c = class_of(need);
+
+		if (c == n_classes) {
+			// Blocks are aligned to their size from the page aligned start
+			// of the heap, which covers any alignment up to a page
+			void *p = buddy_alloc(need);
+			if (p == nullptr)
+				throw std::bad_alloc();
+			if (reinterpret_cast<std::uintptr_t>(p) & (alignment - 1)) {
+				buddy_free(p);
+				throw std::bad_alloc();
+			}
+			try {
+				large_.insert(p);
+			} catch (...) {
+				buddy_free(p);
+				throw;
+			}
+			return p;
+		}
+
+		if (free_[c] == nullptr)
+			refill(c);
+		Piece *p = free_[c];
+		free_[c] = p->next;
+		return p;
+	}
+
+	void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override
+	{
+		const unsigned c = class_of(bytes > alignment ? bytes : alignment);
+
+		if (c == n_classes) {
+			large_.erase(p);
+			buddy_free(p);
+			return;
+		}
+		Piece *piece = static_cast<Piece *>(p);
+		piece->next = free_[c];
+		free_[c] = piece;
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+	{
+		return this == &other;
+	}
+
+	// Cut a fresh page into pieces of class c
+	void refill(unsigned c)
+	{
+		const std::size_t size = min_piece << c;
+		char *page = static_cast<char *>(buddy_alloc(page_size));
+
+		if (page == nullptr)
+			throw std::bad_alloc();
+		try {
+			pages_.push_back(page);
+		} catch (...) {
+			buddy_free(page);
+			throw;
+		}
+		for (std::size_t off = page_size; off >= size; off -= size) {
+			Piece *p = reinterpret_cast<Piece *>(page + off - size);
+			p->next = free_[c];
+			free_[c] = p;
+		}
+	}
+
+	Piece *free_[n_classes] = {};
+	std::vector<void *> pages_;
+	std::unordered_set<void *> large_;
+};
+
+template <class T>
+class BuddyStlAllocator {
+public:
+	using value_type = T;
+
+	BuddyStlAllocator() noexcept : r_(&BuddyResource::shared()) {}
+	explicit BuddyStlAllocator(BuddyResource *r) noexcept : r_(r) {}
+	template <class U>
+	BuddyStlAllocator(const BuddyStlAllocator<U> &other) noexcept : r_(other.resource()) {}
+
+	T *allocate(std::size_t n)
+	{
+		if (n > std::size_t(-1) / sizeof(T))
+			throw std::bad_array_new_length();
+		return static_cast<T *>(r_->allocate(n * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T *p, std::size_t n) noexcept
+	{
+		r_->deallocate(p, n * sizeof(T), alignof(T));
+	}
+
+	BuddyResource *resource() const noexcept { return r_; }
+
+	template <class U>
+	bool operator==(const BuddyStlAllocator<U> &other) const noexcept
+	{
+		return r_ == other.resource();
+	}
+
+	template <class U>
+	bool operator!=(const BuddyStlAllocator<U> &other) const noexcept
+	{
+		return r_ != other.resource();
+	}
+
+private:
+	BuddyResource *r_;
+};
+
+#endif // BUDDY_PMR_HPP
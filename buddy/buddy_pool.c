@@ -0,0 +1,575 @@
+/**
+ * Buddy pools in shared memory
+ *
+ * See buddy_pool.h for an overview.  The segment is laid out as
+ *
+ *   pool_hdr_t | pool_page_t x n_pages | padding | blocks
+ *
+ * with the blocks starting on a page boundary.  Only the head page of a
+ * block describes it: its order, and whether it is free or allocated.
+ * Every other page is marked PAGE_TAIL, which is zero, so a freshly
+ * truncated segment needs no per-page setup.  Free blocks are on doubly
+ * linked lists of page indices, so unlinking a buddy when merging is O(1).
+ */
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#define _GNU_SOURCE		// memfd_create
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "buddy_pool.h"
+
+/**************************************************************************
+ * Private Definitions
+ **************************************************************************/
+
+#define POOL_MAGIC 0x6c6f6f7079646475ull	// "buddypool"
+#define POOL_VERSION 2
+
+#define POOL_PAGE_SIZE ((uint64_t)1 << MIN_ORDER)
+#define NIL UINT32_MAX			// End of a free list
+
+#define ORDER_PAGES(o) ((uint32_t)1 << ((o) - MIN_ORDER))
+
+/**
+ * Page states
+ */
+enum {
+	PAGE_TAIL = 0,		// Not the first page of a block
+	PAGE_FREE,		// First page of a free block
+	PAGE_USED		// First page of an allocated block
+};
+
+/**
+ * @type pool_page_t
+ *
+ * @details Descriptor for one page, linked by index.
+ */
+typedef struct pool_page_t {
+	uint32_t next;
+	uint32_t prev;
+	uint8_t order;
+	uint8_t state;
+} pool_page_t;
+
+/**
+ * @type pool_hdr_t
+ *
+ * @details Start of the segment.  Everything in it is position independent.
+ */
+typedef struct pool_hdr_t {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t max_order;
+	uint64_t map_len;				// Bytes in the segment
+	uint64_t data_off;				// Offset of the first block
+	uint32_t n_pages;
+	uint32_t busy;					// Set while the lists are mid-update
+	uint64_t root;					// Owner's offset, see buddy_pool_root
+	uint32_t free_head[BUDDY_POOL_MAX_ORDER+1];	// First free page per order
+	uint32_t free_count[BUDDY_POOL_MAX_ORDER+1];
+	pthread_mutex_t lock;				// Process shared and robust
+	pool_page_t pages[];
+} pool_hdr_t;
+
+/**
+ * @type buddy_pool_t
+ *
+ * @details One process's view of a pool.
+ */
+struct buddy_pool_t {
+	pool_hdr_t *hdr;	// Where this process mapped the segment
+	char *data;		// First block, in this process
+	int fd;
+	int file;		// Backed by a regular file
+};
+
+
+/**************************************************************************
+ * Local Functions
+ **************************************************************************/
+
+/**
+ * @brief Bytes the segment needs for a pool of the given order.
+ */
+static uint64_t pool_layout(int max_order, uint64_t *data_off)
+{
+	uint64_t n_pages = (uint64_t)1 << (max_order - MIN_ORDER);
+	uint64_t meta = sizeof(pool_hdr_t) + n_pages * sizeof(pool_page_t);
+
+	*data_off = (meta + POOL_PAGE_SIZE - 1) & ~(POOL_PAGE_SIZE - 1);
+	return *data_off + ((uint64_t)1 << max_order);
+}
+
+
+/**
+ * @brief Lock the pool, recovering the lock from a process that died
+ *		between updates.
+ *
+ * A process that died mid-update may have left the lists half linked.
+ * Its lock is then released without being made consistent, which makes
+ * the mutex unrecoverable for every process, and the busy flag stays set
+ * so a file pool is refused on reopen too.
+ *
+ * @return 0 with the lock held, or -1 with errno ENOTRECOVERABLE
+ */
+static int pool_lock(pool_hdr_t *h)
+{
+	int err = pthread_mutex_lock(&h->lock);
+
+	if (err == EOWNERDEAD) {
+		if (h->busy) {
+			fprintf(stderr, "buddy: pool owner died mid-update, pool is unusable\n");
+			pthread_mutex_unlock(&h->lock);
+			errno = ENOTRECOVERABLE;
+			return -1;
+		}
+		fprintf(stderr, "buddy: pool lock recovered from a dead process\n");
+		pthread_mutex_consistent(&h->lock);
+	} else if (err != 0) {
+		errno = err;
+		return -1;
+	}
+	h->busy = 1;
+	return 0;
+}
+
+
+static void pool_unlock(pool_hdr_t *h)
+{
+	h->busy = 0;
+	pthread_mutex_unlock(&h->lock);
+}
+
+
+/**
+ * @brief Set up the lock in the header.
+ */
+static void pool_init_lock(pool_hdr_t *h)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&h->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+
+static void list_push(pool_hdr_t *h, int order, uint32_t i)
+{
+	uint32_t head = h->free_head[order];
+
+	h->pages[i].prev = NIL;
+	h->pages[i].next = head;
+	if (head != NIL)
+		h->pages[head].prev = i;
+	h->free_head[order] = i;
+	h->free_count[order]++;
+}
+
+
+static void list_unlink(pool_hdr_t *h, int order, uint32_t i)
+{
+	pool_page_t *p = &h->pages[i];
+
+	if (p->prev != NIL)
+		h->pages[p->prev].next = p->next;
+	else
+		h->free_head[order] = p->next;
+	if (p->next != NIL)
+		h->pages[p->next].prev = p->prev;
+	h->free_count[order]--;
+}
+
+
+/**
+ * @brief Lay out an empty pool in a zero-filled segment.
+ */
+static void pool_format(pool_hdr_t *h, int max_order, uint64_t map_len, uint64_t data_off)
+{
+	int o;
+
+	h->version = POOL_VERSION;
+	h->max_order = max_order;
+	h->map_len = map_len;
+	h->data_off = data_off;
+	h->n_pages = ORDER_PAGES(max_order);
+
+	for (o = 0; o <= BUDDY_POOL_MAX_ORDER; o++) {
+		h->free_head[o] = NIL;
+		h->free_count[o] = 0;
+	}
+
+	pool_init_lock(h);
+
+	// Every page but the first is already PAGE_TAIL
+	h->pages[0].order = max_order;
+	h->pages[0].state = PAGE_FREE;
+	list_push(h, max_order, 0);
+
+	// Last, so a process that maps the segment early sees no magic
+	__atomic_store_n(&h->magic, POOL_MAGIC, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * @brief Map a pool's segment and wrap it in a handle.
+ *
+ * A file pool is locked to this process, and since no other process can
+ * hold its mutex, the mutex is set up afresh rather than trusted.
+ *
+ * @param fd segment, owned by the handle on success
+ * @param max_order order to format the segment with, or 0 to map an
+ *		existing pool and validate its header
+ * @param file nonzero for a regular file
+ */
+static buddy_pool_t *pool_map(int fd, int max_order, int file)
+{
+	buddy_pool_t *pool;
+	pool_hdr_t *h;
+	uint64_t len, data_off;
+	struct stat st;
+
+	if (file && flock(fd, LOCK_EX | LOCK_NB) != 0) {
+		fprintf(stderr, "buddy: pool file is in use by another process\n");
+		return NULL;
+	}
+
+	if (max_order) {
+		len = pool_layout(max_order, &data_off);
+		if (ftruncate(fd, len) != 0)
+			return NULL;
+	} else {
+		if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(pool_hdr_t))
+			return NULL;
+		len = st.st_size;
+	}
+
+	h = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (h == MAP_FAILED)
+		return NULL;
+
+	if (max_order) {
+		pool_format(h, max_order, len, data_off);
+	} else if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != POOL_MAGIC ||
+		   h->version != POOL_VERSION || h->map_len != len ||
+		   h->max_order < MIN_ORDER || h->max_order > BUDDY_POOL_MAX_ORDER ||
+		   pool_layout(h->max_order, &data_off) != len || h->data_off != data_off) {
+		fprintf(stderr, "buddy: not a buddy pool, or a different version\n");
+		munmap(h, len);
+		return NULL;
+	} else if (file) {
+		if (h->busy) {
+			fprintf(stderr, "buddy: pool file was left mid-update\n");
+			munmap(h, len);
+			return NULL;
+		}
+		pool_init_lock(h);
+	}
+
+	pool = malloc(sizeof(*pool));
+	if (pool == NULL) {
+		munmap(h, len);
+		return NULL;
+	}
+	pool->hdr = h;
+	pool->data = (char *)h + h->data_off;
+	pool->fd = fd;
+	pool->file = file;
+	return pool;
+}
+
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+/**
+ * @brief Make a pool with 1 << max_order bytes of blocks.
+ */
+buddy_pool_t *buddy_pool_create(const char *name, int max_order)
+{
+	buddy_pool_t *pool;
+	int fd;
+
+	if (max_order < MIN_ORDER || max_order > BUDDY_POOL_MAX_ORDER)
+		return NULL;
+
+	if (name != NULL)
+		fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	else
+		fd = memfd_create("buddy_pool", 0);
+	if (fd < 0)
+		return NULL;
+
+	pool = pool_map(fd, max_order, 0);
+	if (pool == NULL) {
+		close(fd);
+		if (name != NULL)
+			shm_unlink(name);
+	}
+	return pool;
+}
+
+
+/**
+ * @brief Map a named pool.
+ */
+buddy_pool_t *buddy_pool_open(const char *name)
+{
+	int fd = shm_open(name, O_RDWR, 0);
+
+	if (fd < 0)
+		return NULL;
+	return buddy_pool_attach(fd);
+}
+
+
+/**
+ * @brief Map the pool behind a descriptor.
+ */
+buddy_pool_t *buddy_pool_attach(int fd)
+{
+	buddy_pool_t *pool = pool_map(fd, 0, 0);
+
+	if (pool == NULL)
+		close(fd);
+	return pool;
+}
+
+
+/**
+ * @brief Make a pool in a new file.  The file starts sparse.
+ */
+buddy_pool_t *buddy_pool_create_file(const char *path, int max_order)
+{
+	buddy_pool_t *pool;
+	int fd;
+
+	if (max_order < MIN_ORDER || max_order > BUDDY_POOL_MAX_ORDER)
+		return NULL;
+
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0)
+		return NULL;
+
+	pool = pool_map(fd, max_order, 1);
+	if (pool == NULL) {
+		close(fd);
+		unlink(path);
+	}
+	return pool;
+}
+
+
+/**
+ * @brief Map a pool file again.  Only the header is checked, so this
+ *		costs the same whatever the pool holds.
+ */
+buddy_pool_t *buddy_pool_open_file(const char *path)
+{
+	buddy_pool_t *pool;
+	int fd = open(path, O_RDWR);
+
+	if (fd < 0)
+		return NULL;
+
+	pool = pool_map(fd, 0, 1);
+	if (pool == NULL)
+		close(fd);
+	return pool;
+}
+
+
+int buddy_pool_sync(buddy_pool_t *pool)
+{
+	return msync(pool->hdr, pool->hdr->map_len, MS_SYNC);
+}
+
+
+int buddy_pool_set_root(buddy_pool_t *pool, uint64_t offset)
+{
+	if (pool_lock(pool->hdr) != 0)
+		return -1;
+	pool->hdr->root = offset;
+	pool_unlock(pool->hdr);
+	return 0;
+}
+
+
+uint64_t buddy_pool_root(const buddy_pool_t *pool)
+{
+	return __atomic_load_n(&pool->hdr->root, __ATOMIC_ACQUIRE);
+}
+
+
+int buddy_pool_fd(const buddy_pool_t *pool)
+{
+	return pool->fd;
+}
+
+
+void buddy_pool_close(buddy_pool_t *pool)
+{
+	if (pool->file)
+		buddy_pool_sync(pool);
+	munmap(pool->hdr, pool->hdr->map_len);
+	close(pool->fd);
+	free(pool);
+}
+
+
+int buddy_pool_unlink(const char *name)
+{
+	return shm_unlink(name);
+}
+
+
+/**
+ * @brief Allocate a block: take the smallest free block big enough and
+ *		split it down, pushing right halves on their free lists.
+ */
+void *buddy_pool_alloc(buddy_pool_t *pool, size_t size)
+{
+	pool_hdr_t *h = pool->hdr;
+	int order = MIN_ORDER, o;
+	uint32_t i;
+
+	if (size > ((uint64_t)1 << h->max_order))
+		return NULL;
+	while (((uint64_t)1 << order) < size)
+		order++;
+
+	if (pool_lock(h) != 0)
+		return NULL;
+
+	for (o = order; o <= (int)h->max_order && h->free_head[o] == NIL; o++)
+		;
+	if (o > (int)h->max_order) {
+		pool_unlock(h);
+		return NULL;
+	}
+
+	i = h->free_head[o];
+	list_unlink(h, o, i);
+
+	while (o > order) {
+		o--;
+		uint32_t right = i + ORDER_PAGES(o);
+		h->pages[right].order = o;
+		h->pages[right].state = PAGE_FREE;
+		list_push(h, o, right);
+	}
+
+	h->pages[i].order = order;
+	h->pages[i].state = PAGE_USED;
+
+	pool_unlock(h);
+
+	return pool->data + (uint64_t)i * POOL_PAGE_SIZE;
+}
+
+
+/**
+ * @brief Free a block, merging it with its buddy for as long as the buddy
+ *		is a free block of the same order.
+ */
+void buddy_pool_free(buddy_pool_t *pool, void *addr)
+{
+	pool_hdr_t *h = pool->hdr;
+	uint64_t off = (char *)addr - pool->data;
+	uint32_t i, buddy;
+	int o;
+
+	if ((char *)addr < pool->data || off % POOL_PAGE_SIZE != 0 ||
+	    off / POOL_PAGE_SIZE >= h->n_pages)
+		return;
+	i = off / POOL_PAGE_SIZE;
+
+	if (pool_lock(h) != 0)
+		return;
+
+	// Not the start of an allocated block, nothing sensible to do
+	if (h->pages[i].state != PAGE_USED) {
+		pool_unlock(h);
+		return;
+	}
+
+	for (o = h->pages[i].order; o < (int)h->max_order; o++) {
+		buddy = i ^ ORDER_PAGES(o);
+		if (h->pages[buddy].state != PAGE_FREE || h->pages[buddy].order != o)
+			break;
+
+		list_unlink(h, o, buddy);
+		// The higher half stops being a block head
+		h->pages[i > buddy ? i : buddy].state = PAGE_TAIL;
+		i = i < buddy ? i : buddy;
+	}
+
+	h->pages[i].order = o;
+	h->pages[i].state = PAGE_FREE;
+	list_push(h, o, i);
+
+	pool_unlock(h);
+}
+
+
+uint64_t buddy_pool_offset(const buddy_pool_t *pool, const void *addr)
+{
+	return (const char *)addr - (const char *)pool->hdr;
+}
+
+
+void *buddy_pool_ptr(const buddy_pool_t *pool, uint64_t offset)
+{
+	return (char *)pool->hdr + offset;
+}
+
+
+int buddy_pool_free_count(buddy_pool_t *pool, int order)
+{
+	int n;
+
+	if (order < MIN_ORDER || order > (int)pool->hdr->max_order)
+		return 0;
+
+	if (pool_lock(pool->hdr) != 0)
+		return -1;
+	n = pool->hdr->free_count[order];
+	pool_unlock(pool->hdr);
+	return n;
+}
+
+
+/**
+ * @brief List an order's free blocks, as offsets from the start of the
+ *		segment like buddy_pool_offset gives.
+ */
+int buddy_pool_free_offsets(buddy_pool_t *pool, int order, uint64_t *offsets, int max)
+{
+	pool_hdr_t *h = pool->hdr;
+	uint32_t i;
+	int n = 0;
+
+	if (order < MIN_ORDER || order > (int)h->max_order)
+		return 0;
+
+	if (pool_lock(h) != 0)
+		return -1;
+	for (i = h->free_head[order]; i != NIL && n < max; i = h->pages[i].next)
+		offsets[n++] = h->data_off + (uint64_t)i * POOL_PAGE_SIZE;
+	pool_unlock(h);
+	return n;
+}
@@ -0,0 +1,85 @@
+#ifndef BUDDY_POOL_H
+#define BUDDY_POOL_H
+
+/*
+ * Buddy pools shared between processes.
+ *
+ * A pool is a buddy heap that lives entirely inside one shared mapping:
+ * a header, one descriptor per page and then the blocks.  The free lists
+ * link descriptors by page index rather than by pointer and blocks are
+ * named by their offset from the start of the mapping, so every process
+ * can map the segment at a different address.  A process-shared, robust
+ * mutex in the header serializes the processes.  A process that dies
+ * between calls leaves the pool usable, but one that dies in the middle of
+ * an allocation or free may leave the lists half linked, and the pool is
+ * then unusable: calls fail with errno ENOTRECOVERABLE in every process.
+ *
+ * Pools are made with shm_open when given a name, or memfd_create without
+ * one, in which case the descriptor is passed on by fork or over a Unix
+ * socket and mapped with buddy_pool_attach.  Pass offsets, not pointers,
+ * between processes, and convert with buddy_pool_ptr and buddy_pool_offset.
+ *
+ * A pool can also live in a regular file, where it outlasts the process.
+ * Reopening the file checks the header and maps it again; no list is
+ * rebuilt.  The root offset in the header is where the owner keeps the
+ * way back into its data.  A file pool has one owner at a time, which
+ * holds a lock on the file, and it is refused on reopen if a process died
+ * in the middle of an allocation or free.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buddy.h"
+
+#define BUDDY_POOL_MAX_ORDER 40		// Largest pool, 1 TiB of blocks
+
+typedef struct buddy_pool_t buddy_pool_t;
+
+// Make a pool with 1 << max_order bytes of blocks. NULL name uses memfd.
+buddy_pool_t *buddy_pool_create(const char *name, int max_order);
+
+// Map the pool made under name by another process
+buddy_pool_t *buddy_pool_open(const char *name);
+
+// Map the pool behind fd, which the pool then owns
+buddy_pool_t *buddy_pool_attach(int fd);
+
+// Make a pool in a new file, or map the one a previous run left
+buddy_pool_t *buddy_pool_create_file(const char *path, int max_order);
+buddy_pool_t *buddy_pool_open_file(const char *path);
+
+// Write a file pool out to disk. Returns 0 on success.
+int buddy_pool_sync(buddy_pool_t *pool);
+
+// Offset kept in the header for the owner to find its data again
+// Returns 0, or -1 if the pool is unusable.
+int buddy_pool_set_root(buddy_pool_t *pool, uint64_t offset);
+uint64_t buddy_pool_root(const buddy_pool_t *pool);
+
+// Descriptor of the pool's segment, to pass to other processes
+int buddy_pool_fd(const buddy_pool_t *pool);
+
+// Unmap the pool in this process, syncing a file pool first. The segment
+// lives on while mapped.
+void buddy_pool_close(buddy_pool_t *pool);
+
+// Remove a named pool. Processes that have it mapped keep it.
+int buddy_pool_unlink(const char *name);
+
+// Allocate and free blocks
+void *buddy_pool_alloc(buddy_pool_t *pool, size_t size);
+void buddy_pool_free(buddy_pool_t *pool, void *addr);
+
+// Convert between this process's addresses and offsets valid in every process
+uint64_t buddy_pool_offset(const buddy_pool_t *pool, const void *addr);
+void *buddy_pool_ptr(const buddy_pool_t *pool, uint64_t offset);
+
+// Number of free blocks of an order, or -1 if the pool is unusable
+int buddy_pool_free_count(buddy_pool_t *pool, int order);
+
+// Offsets of up to max free blocks of an order, in list order. Returns the
+// number stored, or -1 if the pool is unusable.
+int buddy_pool_free_offsets(buddy_pool_t *pool, int order, uint64_t *offsets, int max);
+
+#endif // BUDDY_POOL_H
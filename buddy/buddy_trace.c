@@ -0,0 +1,251 @@
+/**
+ * Allocation event tracer
+ *
+ * See buddy_trace.h for an overview.
+ */
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buddy.h"
+#include "buddy_trace.h"
+#include "cycles.h"
+
+/**************************************************************************
+ * Private Types
+ **************************************************************************/
+
+/**
+ * @type trace_ring_t
+ *
+ * @details Per-thread ring of records.  Written only by its owning thread;
+ * head counts every record ever written so the reader can tell how many were
+ * overwritten.
+ */
+typedef struct trace_ring_t {
+	struct trace_ring_t *next;	// Next ring in the registry
+	uint16_t thread;		// Id stamped into each record
+	uint32_t mask;			// Capacity - 1
+	atomic_ullong head;		// Total records written
+	atomic_int retired;		// Replaced by a ring of another size
+	trace_rec_t buf[];
+} trace_ring_t;
+
+
+/**************************************************************************
+ * Global Variables
+ **************************************************************************/
+
+atomic_int buddy_trace_on = 0;
+
+/* all rings ever created, pushed lock-free */
+static _Atomic(trace_ring_t *) g_rings = NULL;
+
+/* ring size for rings created from now on */
+static atomic_uint g_ring_size = TRACE_DEFAULT_RING;
+
+/* source of thread ids */
+static atomic_uint g_next_thread = 0;
+
+/* the calling thread's ring, created on its first record */
+static __thread trace_ring_t *t_ring = NULL;
+
+
+/**************************************************************************
+ * Local Functions
+ **************************************************************************/
+
+/**
+ * @brief Create a ring of the current size for the calling thread and
+ * 		publish it in the registry.
+ *
+ * @param old the thread's previous ring, whose id the new one keeps, or NULL
+ */
+static trace_ring_t *ring_create(trace_ring_t *old)
+{
+	unsigned size = atomic_load(&g_ring_size);
+	trace_ring_t *ring = calloc(1, sizeof(*ring) + size * sizeof(trace_rec_t));
+
+	if (NULL == ring) {
+		return NULL;
+	}
+
+	ring->mask = size - 1;
+	if (NULL != old) {
+		ring->thread = old->thread;
+	} else {
+		ring->thread = (uint16_t)atomic_fetch_add(&g_next_thread, 1);
+	}
+
+	ring->next = atomic_load(&g_rings);
+	while (!atomic_compare_exchange_weak(&g_rings, &ring->next, ring))
+		;
+
+	return ring;
+}
+
+
+/**
+ * @brief Order records by timestamp, then by thread for stability.
+ */
+static int rec_cmp(const void *a, const void *b)
+{
+	const trace_rec_t *ra = a;
+	const trace_rec_t *rb = b;
+
+	if (ra->tsc != rb->tsc) {
+		return ra->tsc < rb->tsc ? -1 : 1;
+	}
+	return (int)ra->thread - (int)rb->thread;
+}
+
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+/**
+ * @brief Enable tracing.  Rings are emptied, so each start begins a fresh
+ * 		trace.  Should be called while no allocations are in flight.
+ * 		A thread whose ring has another size gets a new ring on its
+ * 		next record; the old one stays registered, empty, since a
+ * 		concurrent buddy_trace_write may still be reading it.
+ *
+ * @param ring_size records per thread, rounded up to a power of two
+ */
+void buddy_trace_start(unsigned ring_size)
+{
+	unsigned size = 1;
+	trace_ring_t *ring;
+
+	if (0 == ring_size) {
+		ring_size = TRACE_DEFAULT_RING;
+	}
+	while (size < ring_size) {
+		size <<= 1;
+	}
+	atomic_store(&g_ring_size, size);
+
+	for (ring = atomic_load(&g_rings); NULL != ring; ring = ring->next) {
+		atomic_store(&ring->head, 0);
+	}
+
+	atomic_store(&buddy_trace_on, 1);
+}
+
+
+/**
+ * @brief Disable tracing.
+ */
+void buddy_trace_stop()
+{
+	atomic_store(&buddy_trace_on, 0);
+}
+
+
+/**
+ * @brief Append a record to the calling thread's ring.
+ */
+void buddy_trace_record(trace_op_t op, int order, unsigned long page)
+{
+	trace_ring_t *ring = t_ring;
+
+	if (NULL == ring || ring->mask + 1 != atomic_load_explicit(&g_ring_size, memory_order_relaxed)) {
+		trace_ring_t *fresh = ring_create(ring);
+
+		if (NULL == fresh) {
+			return;
+		}
+		if (NULL != ring) {
+			atomic_store(&ring->retired, 1);
+		}
+		ring = t_ring = fresh;
+	}
+
+	unsigned long long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	trace_rec_t *rec = &ring->buf[head & ring->mask];
+
+	rec->tsc = read_cycles();
+	rec->page = (uint32_t)page;
+	rec->thread = ring->thread;
+	rec->op = (uint8_t)op;
+	rec->order = (uint8_t)order;
+
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+
+/**
+ * @brief Write every thread's records, merged by timestamp, to a file.
+ *
+ * @note Rings that are still being written while this runs may hand back a
+ * 	 few torn records at the wrap point; stop tracing first for a clean dump.
+ *
+ * @return 0 on success, -1 on allocation or I/O failure
+ */
+int buddy_trace_write(FILE *out)
+{
+	trace_file_hdr_t hdr;
+	trace_ring_t *ring;
+	trace_rec_t *all;
+	unsigned long long total = 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+	hdr.version = TRACE_VERSION;
+	hdr.rec_size = sizeof(trace_rec_t);
+	hdr.min_order = MIN_ORDER;
+	hdr.max_order = MAX_ORDER;
+
+	// Size the merge buffer
+	for (ring = atomic_load(&g_rings); NULL != ring; ring = ring->next) {
+		if (atomic_load(&ring->retired)) {
+			continue;
+		}
+
+		unsigned long long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		unsigned long long cap = (unsigned long long)ring->mask + 1;
+
+		total += head < cap ? head : cap;
+		hdr.threads++;
+	}
+
+	all = malloc((total ? total : 1) * sizeof(trace_rec_t));
+	if (NULL == all) {
+		return -1;
+	}
+
+	// Copy out the live window of each ring, oldest first
+	for (ring = atomic_load(&g_rings); NULL != ring; ring = ring->next) {
+		if (atomic_load(&ring->retired)) {
+			continue;
+		}
+
+		unsigned long long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		unsigned long long cap = (unsigned long long)ring->mask + 1;
+		unsigned long long first = head > cap ? head - cap : 0;
+		unsigned long long i;
+
+		if (head > cap) {
+			hdr.dropped += head - cap;
+		}
+		for (i = first; i < head && hdr.count < total; i++) {
+			all[hdr.count++] = ring->buf[i & ring->mask];
+		}
+	}
+
+	qsort(all, hdr.count, sizeof(trace_rec_t), rec_cmp);
+
+	int ret = 0;
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 ||
+	    fwrite(all, sizeof(trace_rec_t), hdr.count, out) != hdr.count) {
+		ret = -1;
+	}
+
+	free(all);
+	return ret;
+}
@@ -0,0 +1,98 @@
+#ifndef BUDDY_TRACE_H
+#define BUDDY_TRACE_H
+
+/*
+ * Allocation event tracer.
+ *
+ * Every buddy_alloc and buddy_free can append a fixed-size binary record to a
+ * ring buffer owned by the calling thread.  Only the owning thread ever
+ * writes its ring, so recording is a plain store plus one release store of
+ * the head index.  Rings are flight recorders: once full, the oldest records
+ * are overwritten.
+ *
+ * Tracing is switched on and off at run time.  When it is off the cost at
+ * each call site is a single relaxed load of buddy_trace_on.
+ *
+ * buddy_trace_write dumps every ring to a file, which trace_decode turns back
+ * into the simulator's alloc/free script syntax.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+/**
+ * Traced operations
+ */
+typedef enum trace_op_t {
+	TRACE_ALLOC = 1,	///< Successful allocation
+	TRACE_ALLOC_FAIL,	///< Allocation which returned NULL
+	TRACE_FREE		///< Free of an allocated block
+} trace_op_t;
+
+/**
+ * @type trace_rec_t
+ *
+ * @details One traced event.  The layout is fixed so that dumps can be
+ * decoded on another machine.
+ */
+typedef struct trace_rec_t {
+	uint64_t tsc;		///< Timestamp, see read_cycles()
+	uint32_t page;		///< Block offset from the arena start, in pages
+	uint16_t thread;	///< Small sequential id of the recording thread
+	uint8_t op;		///< One of trace_op_t
+	uint8_t order;		///< Block order (requested order for failures)
+} trace_rec_t;
+
+/**
+ * @type trace_file_hdr_t
+ *
+ * @details Header at the start of a trace dump, followed by `count` records
+ * sorted by timestamp.
+ */
+typedef struct trace_file_hdr_t {
+	char magic[8];		///< TRACE_MAGIC
+	uint32_t version;	///< TRACE_VERSION
+	uint32_t rec_size;	///< sizeof(trace_rec_t) of the writer
+	uint32_t min_order;	///< MIN_ORDER of the writer, to scale pages
+	uint32_t max_order;	///< MAX_ORDER of the writer
+	uint32_t threads;	///< Number of rings that were dumped
+	uint32_t reserved;	///< Zero
+	uint64_t count;		///< Number of records following the header
+	uint64_t dropped;	///< Records lost to ring wrap-around
+} trace_file_hdr_t;
+
+#define TRACE_MAGIC "BDYTRACE"
+#define TRACE_VERSION 1
+
+/* Default number of records per thread, must be a power of two */
+#define TRACE_DEFAULT_RING (1 << 16)
+
+/* Nonzero while tracing is enabled, read on every allocator call */
+extern atomic_int buddy_trace_on;
+
+// Enable tracing with rings of at least ring_size records per thread. A
+// ring_size of 0 selects TRACE_DEFAULT_RING. Threads that already traced
+// with another size switch to a new ring on their next record.
+void buddy_trace_start(unsigned ring_size);
+
+// Disable tracing.  Recorded events are kept until the next start.
+void buddy_trace_stop();
+
+// Append one record to the calling thread's ring
+void buddy_trace_record(trace_op_t op, int order, unsigned long page);
+
+// Write all rings to the given file, returns 0 on success
+int buddy_trace_write(FILE *out);
+
+/*
+ * Call-site hook for the allocator. The branch is all that tracing costs when
+ * it is disabled.
+ */
+#define BUDDY_TRACE(op, order, page)						\
+	do {									\
+		if (atomic_load_explicit(&buddy_trace_on, memory_order_relaxed))	\
+			buddy_trace_record((op), (order), (page));		\
+	} while (0)
+
+#endif // BUDDY_TRACE_H
@@ -0,0 +1,34 @@
+#ifndef CYCLES_H
+#define CYCLES_H
+
+/*
+ * Cheap timestamp source shared by the tracer and the instrumentation code.
+ *
+ * On x86 this is the time stamp counter, which is a handful of cycles to
+ * read.  Everywhere else we fall back on the monotonic clock in nanoseconds,
+ * which is still a vDSO call rather than a real system call.
+ */
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <x86intrin.h>
+#else
+#  include <time.h>
+#endif
+
+/**
+ * @brief Read the current timestamp counter.
+ */
+static inline uint64_t read_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+#endif // CYCLES_H
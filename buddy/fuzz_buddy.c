@@ -0,0 +1,541 @@
+/*
+ * Differential fuzzer for the buddy allocator.
+ *
+ * Runs alloc/free sequences against both buddy.c and a deliberately simple
+ * reference model, and after every step checks that both returned the same
+ * offset and hold the same free blocks in the same list order.  The model
+ * keeps each order's list as a plain array and follows the allocator's list
+ * discipline:
+ *
+ *  - an allocation takes the first free block on the smallest order that
+ *    has one
+ *  - each split pushes the right half onto the head of the next order down,
+ *    and the allocated left half goes on the tail of the target order
+ *  - a merged block is pushed onto the head of the next order up
+ *
+ * so any rewrite of buddy_alloc/buddy_free that changes which block a
+ * request gets fails here, not just one that corrupts the heap.
+ *
+ * Built with BUDDY_FUZZ_POOL, the same driver runs a fresh buddy_pool.h
+ * pool per input instead.  Pools take allocated blocks off the lists, so
+ * there a freed block that does not merge goes back on the head of its
+ * list rather than staying where it was; the model does the same.
+ *
+ * In a USE_CHECK build the allocator also checks the whole heap on every
+ * call, which is much slower but catches corruption the model cannot see.
+ *
+ * Built as a standalone driver by default, which feeds random inputs or
+ * replays saved ones.  With BUDDY_LIBFUZZER defined the same input decoder
+ * becomes LLVMFuzzerTestOneInput instead.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buddy.h"
+#ifdef BUDDY_FUZZ_POOL
+#include "buddy_pool.h"
+#endif
+
+#define PAGE_SIZE ((size_t)1 << MIN_ORDER)
+#define N_PAGES (1 << (MAX_ORDER - MIN_ORDER))
+#define MAX_LIVE 1024
+
+/**************************************************************************
+ * Reference model
+ **************************************************************************/
+
+/**
+ * @type ref_block_t
+ *
+ * @details One entry on an order's list.  Allocated blocks stay on the list
+ * 		of their order, as they do in buddy.c.
+ */
+typedef struct ref_block_t {
+	size_t off;
+	int free;
+} ref_block_t;
+
+// An order's list never holds more entries than the heap has blocks of
+// that order, so each is sized to that rather than to the page count
+static ref_block_t *ref_list[MAX_ORDER + 1];
+static int ref_len[MAX_ORDER + 1];
+
+static int ref_find(int order, size_t off)
+{
+	int i;
+
+	for (i = 0; i < ref_len[order]; i++) {
+		if (ref_list[order][i].off == off)
+			return i;
+	}
+	return -1;
+}
+
+static void ref_push_head(int order, size_t off, int free)
+{
+	memmove(&ref_list[order][1], &ref_list[order][0], ref_len[order] * sizeof(ref_block_t));
+	ref_list[order][0].off = off;
+	ref_list[order][0].free = free;
+	ref_len[order]++;
+}
+
+static void ref_push_tail(int order, size_t off, int free)
+{
+	ref_list[order][ref_len[order]].off = off;
+	ref_list[order][ref_len[order]].free = free;
+	ref_len[order]++;
+}
+
+static void ref_remove(int order, int i)
+{
+	memmove(&ref_list[order][i], &ref_list[order][i + 1],
+		(ref_len[order] - i - 1) * sizeof(ref_block_t));
+	ref_len[order]--;
+}
+
+static void ref_init()
+{
+	int o;
+
+	for (o = MIN_ORDER; o <= MAX_ORDER; o++) {
+		if (ref_list[o] == NULL)
+			ref_list[o] = calloc((size_t)1 << (MAX_ORDER - o), sizeof(ref_block_t));
+		if (ref_list[o] == NULL) {
+			fprintf(stderr, "fuzz_buddy: out of memory for the model\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	memset(ref_len, 0, sizeof(ref_len));
+	ref_push_head(MAX_ORDER, 0, 1);
+}
+
+/**
+ * @brief Model of buddy_alloc.
+ *
+ * @return offset of the block, or -1 where buddy_alloc returns NULL
+ */
+static long ref_alloc(size_t size)
+{
+	int target = MIN_ORDER;
+	int order, i;
+
+	if (size > ((size_t)1 << MAX_ORDER))
+		return -1;
+	while (((size_t)1 << target) < size)
+		target++;
+
+	for (order = target; order <= MAX_ORDER; order++) {
+		for (i = 0; i < ref_len[order]; i++) {
+			if (ref_list[order][i].free)
+				break;
+		}
+		if (i < ref_len[order])
+			break;
+	}
+	if (order > MAX_ORDER)
+		return -1;
+
+	size_t off = ref_list[order][i].off;
+
+	if (order == target) {
+		ref_list[order][i].free = 0;
+		return off;
+	}
+
+	ref_remove(order, i);
+	while (order > target) {
+		order--;
+		ref_push_head(order, off + (1ul << order), 1);
+	}
+	ref_push_tail(target, off, 0);
+	return off;
+}
+
+/**
+ * @brief Model of buddy_free.
+ */
+static void ref_free(size_t off)
+{
+	int order, i, j;
+
+	for (order = MIN_ORDER; order <= MAX_ORDER; order++) {
+		if ((i = ref_find(order, off)) >= 0)
+			break;
+	}
+	if (order > MAX_ORDER)
+		return;
+
+	while (order < MAX_ORDER) {
+		j = ref_find(order, off ^ (1ul << order));
+		if (j < 0 || !ref_list[order][j].free)
+			break;
+
+		// Remove the higher index first so the lower one stays valid
+		ref_remove(order, i > j ? i : j);
+		ref_remove(order, i > j ? j : i);
+
+		off &= ~(1ul << order);
+		order++;
+		ref_push_head(order, off, 1);
+		i = 0;
+	}
+#ifdef BUDDY_FUZZ_POOL
+	ref_remove(order, i);
+	ref_push_head(order, off, 1);
+#else
+	ref_list[order][i].free = 1;
+#endif
+}
+
+/**************************************************************************
+ * Allocator under test
+ **************************************************************************/
+
+static char *arena;			// Start of the allocator's memory
+
+#ifdef BUDDY_FUZZ_POOL
+
+static buddy_pool_t *pool;
+
+/**
+ * @brief Start each input on a new pool, which maps somewhere else.
+ */
+static void heap_init()
+{
+	if (pool != NULL)
+		buddy_pool_close(pool);
+	pool = buddy_pool_create(NULL, MAX_ORDER);
+	if (pool == NULL) {
+		fprintf(stderr, "fuzz_buddy: cannot create a pool\n");
+		exit(EXIT_FAILURE);
+	}
+	arena = buddy_pool_alloc(pool, (size_t)1 << MAX_ORDER);
+	buddy_pool_free(pool, arena);
+}
+
+static void *heap_alloc(size_t size)
+{
+	return buddy_pool_alloc(pool, size);
+}
+
+static void heap_free(void *addr)
+{
+	buddy_pool_free(pool, addr);
+}
+
+static int heap_free_count(int order)
+{
+	return buddy_pool_free_count(pool, order);
+}
+
+/**
+ * @brief Free blocks of an order as offsets from the first block, like
+ *		buddy_free_offsets.
+ */
+static int heap_free_offsets(int order, size_t *offsets, int max)
+{
+	static uint64_t seg[N_PAGES];
+	uint64_t base = buddy_pool_offset(pool, arena);
+	int i, n = buddy_pool_free_offsets(pool, order, seg, max);
+
+	for (i = 0; i < n; i++)
+		offsets[i] = seg[i] - base;
+	return n;
+}
+
+#else
+
+/**
+ * @brief Reset the heap, and find where it starts on the first call: the
+ *		only order MAX_ORDER block.  Allocating and freeing it leaves
+ *		the allocator exactly as initialized.
+ */
+static void heap_init()
+{
+	buddy_init();
+	if (arena == NULL) {
+		arena = buddy_alloc((size_t)1 << MAX_ORDER);
+		buddy_free(arena);
+	}
+}
+
+static void *heap_alloc(size_t size)
+{
+	return buddy_alloc(size);
+}
+
+static void heap_free(void *addr)
+{
+	buddy_free(addr);
+}
+
+static int heap_free_count(int order)
+{
+	return buddy_free_count(order);
+}
+
+static int heap_free_offsets(int order, size_t *offsets, int max)
+{
+	return buddy_free_offsets(order, offsets, max);
+}
+
+#endif // BUDDY_FUZZ_POOL
+
+/**************************************************************************
+ * Differential driver
+ **************************************************************************/
+
+static char *live[MAX_LIVE];		// Blocks handed out and not yet freed
+static int n_live;
+static unsigned long ops_run;
+
+/**
+ * @brief Report a divergence with the step that caused it, and abort so the
+ * 		fuzzer keeps the input.
+ */
+static void diverged(int step, const char *what)
+{
+	int o, i;
+
+	fprintf(stderr, "fuzz_buddy: step %d: %s\n", step, what);
+	for (o = MIN_ORDER; o <= MAX_ORDER; o++) {
+		static size_t offs[N_PAGES];
+		int n = heap_free_offsets(o, offs, N_PAGES);
+
+		fprintf(stderr, "  order %2d buddy:", o);
+		for (i = 0; i < n; i++)
+			fprintf(stderr, " %zx", offs[i]);
+		fprintf(stderr, "\n           model:");
+		for (i = 0; i < ref_len[o]; i++) {
+			if (ref_list[o][i].free)
+				fprintf(stderr, " %zx", ref_list[o][i].off);
+		}
+		fprintf(stderr, "\n");
+	}
+	abort();
+}
+
+/**
+ * @brief Compare every order's free list, in list order.
+ */
+static void compare_free_area(int step)
+{
+	static size_t offs[N_PAGES];
+	int o, i, n, k;
+
+	for (o = MIN_ORDER; o <= MAX_ORDER; o++) {
+		n = heap_free_offsets(o, offs, N_PAGES);
+		if (n != heap_free_count(o))
+			diverged(step, "free offsets and free count disagree");
+
+		for (i = 0, k = 0; i < ref_len[o]; i++) {
+			if (!ref_list[o][i].free)
+				continue;
+			if (k >= n || offs[k] != ref_list[o][i].off)
+				diverged(step, "free lists differ");
+			k++;
+		}
+		if (k != n)
+			diverged(step, "free lists differ");
+	}
+}
+
+/**
+ * @brief Decode a request size from two bytes.
+ *
+ * Mostly sizes just over a power of two, spread over every order with small
+ * orders favoured, plus the edge cases: 0, exact powers of two, too large,
+ * and negative ints as a caller that mixed up signedness would pass them.
+ */
+static size_t decode_size(uint8_t a, uint8_t b)
+{
+	int span = MAX_ORDER - MIN_ORDER + 1;
+	int o1 = MIN_ORDER + (a >> 4) % span;
+	int o2 = MIN_ORDER + b % span;
+	int order = o1 < o2 ? o1 : o2;
+
+	switch (a & 0xf) {
+	case 0:
+		return 0;
+	case 1:
+		return (size_t)(-1 - b);
+	case 2:
+		return ((size_t)1 << MAX_ORDER) + 1 + b;
+	case 3:
+		return (size_t)1 << order;
+	default:
+		return ((size_t)1 << (order - 1)) + 1 +
+		       ((size_t)(b * 2654435761u) & (((size_t)1 << (order - 1)) - 1));
+	}
+}
+
+/**
+ * @brief Run one input: each 3-byte step is an alloc, a free of a live
+ * 		block, or a free of an address that starts no block.
+ */
+static void run_input(const uint8_t *data, size_t len)
+{
+	size_t pos;
+	int step = 0;
+
+	heap_init();
+	ref_init();
+	n_live = 0;
+
+	for (pos = 0; pos + 3 <= len; pos += 3, step++) {
+		uint8_t op = data[pos];
+
+		if (op < 128 || n_live == 0) {
+			if (n_live == MAX_LIVE)
+				continue;
+
+			size_t size = decode_size(data[pos + 1], data[pos + 2]);
+			char *p = heap_alloc(size);
+			long expect = ref_alloc(size);
+
+			if ((p == NULL) != (expect < 0) ||
+			    (p != NULL && p - arena != expect)) {
+				char msg[128];
+				snprintf(msg, sizeof(msg), "alloc(%zu) returned offset %ld, model %ld",
+					 size, p ? (long)(p - arena) : -1l, expect);
+				diverged(step, msg);
+			}
+			if (p != NULL)
+				live[n_live++] = p;
+		}
+		else if (op < 252) {
+			int i = (data[pos + 1] | data[pos + 2] << 8) % n_live;
+			char *p = live[i];
+
+			live[i] = live[--n_live];
+			heap_free(p);
+			ref_free(p - arena);
+		}
+		else {
+			// Inside the arena but not page aligned, so never a block
+			size_t off = ((data[pos + 1] | data[pos + 2] << 8) * PAGE_SIZE) %
+				     ((size_t)1 << MAX_ORDER);
+			heap_free(arena + off + 1 + (op & 0xf));
+		}
+
+		compare_free_area(step);
+		ops_run++;
+	}
+}
+
+#ifdef BUDDY_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t len)
+{
+	run_input(data, len);
+	return 0;
+}
+
+#else
+
+#include <getopt.h>
+
+static uint64_t rng_state;
+
+/**
+ * @brief xorshift64*, plenty for test inputs.
+ */
+static inline uint64_t rng_next()
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545F4914F6CDD1Dull;
+}
+
+/**
+ * Output program manual
+ *
+ * @param prog_name Name of the program passed in as a command line argument.
+ * @param out File stream to write to.
+ */
+static void print_usage(char* prog_name, FILE* out)
+{
+	fprintf(out, "Usage:\n");
+	fprintf(out, "  %s [-n runs] [-l steps] [-s seed] [input files...]\n", prog_name);
+	fprintf(out, "     -n [optional] - Random inputs to run, 1000 by default.\n");
+	fprintf(out, "     -l [optional] - Steps per random input, 2000 by default.\n");
+	fprintf(out, "     -s [optional] - Random seed, 1 by default.\n");
+	fprintf(out, "  Input files, such as saved libFuzzer crashes, are replayed instead.\n");
+}
+
+int main(int argc, char** argv)
+{
+	long runs = 1000;
+	long steps = 2000;
+	uint64_t seed = 1;
+	int opt;
+	long r;
+
+	while ((opt = getopt(argc, argv, "n:l:s:")) != -1) {
+		switch (opt) {
+		case 'n':
+			runs = atol(optarg);
+			break;
+		case 'l':
+			steps = atol(optarg);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			print_usage(argv[0], stderr);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind < argc) {
+		int n_inputs = argc - optind;
+
+		for (; optind < argc; optind++) {
+			FILE *in = fopen(argv[optind], "rb");
+			uint8_t buf[1 << 16];
+			size_t len;
+
+			if (in == NULL) {
+				perror("ERROR: Failed to open input file.");
+				return EXIT_FAILURE;
+			}
+			len = fread(buf, 1, sizeof(buf), in);
+			fclose(in);
+			run_input(buf, len);
+		}
+		printf("Replayed %d inputs, %lu steps: no divergence\n", n_inputs, ops_run);
+		return EXIT_SUCCESS;
+	}
+
+	uint8_t *buf = malloc(steps * 3);
+	if (buf == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	rng_state = seed * 0x9E3779B97F4A7C15ull + 1;
+	for (r = 0; r < runs; r++) {
+		long i;
+
+		// Vary the alloc/free balance between runs so some fill the
+		// arena and others keep it nearly empty
+		uint8_t bias = rng_next();
+		for (i = 0; i < steps * 3; i++) {
+			buf[i] = rng_next();
+			if (i % 3 == 0 && (uint8_t)rng_next() < bias)
+				buf[i] |= 0x80;
+		}
+		run_input(buf, steps * 3);
+	}
+
+	free(buf);
+	printf("Ran %ld inputs, %lu steps: no divergence\n", runs, ops_run);
+	return EXIT_SUCCESS;
+}
+
+#endif // BUDDY_LIBFUZZER
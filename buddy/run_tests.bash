@@ -1,7 +1,6 @@
 #!/bin/bash
 
 TEST_DIR=./test-files
-TMP_FILE=$TEST_DIR/.tmp
 
 TEST_PREFIX=test_
 RESULT_PREFIX=result_
@@ -12,16 +11,28 @@ UNCHECKED_TESTS=""
 
 VERBOSE=0
 VERBOSE_DIFF=0
+UPDATE=0
+JOBS=`nproc 2>/dev/null || echo 4`
+
+BUDDY=./buddy
 
 usage() {
-    printf "Usage $0 [-dv]\n" 1>&2
+    printf "Usage $0 [-dvu] [-b simulator] [-j jobs] [test files...]\n" 1>&2
+    printf "\tb - Simulator binary to test (default ./buddy)\n"
     printf "\td - Output diff of result and expected result on test failure\n"
     printf "\tv - Output result and expected result on test failue\n"
+    printf "\tj - Tests to run at once (default: number of CPUs)\n"
+    printf "\tu - Regenerate the expected result files from the current output\n"
+    printf "\tWith no test files, every $TEST_PREFIX* file in $TEST_DIR is run.\n"
     exit 1
 }
 
-while getopts "dv" o; do
+while getopts "dvub:j:" o; do
     case "${o}" in
+        b)
+            BUDDY=${OPTARG}
+            ;;
+
         d)
             VERBOSE_DIFF=1
             ;;
@@ -30,26 +41,74 @@ while getopts "dv" o; do
             VERBOSE=1
             ;;
 
+        u)
+            UPDATE=1
+            ;;
+
+        j)
+            JOBS=${OPTARG}
+            ;;
+
         *)
             usage
             ;;
 
     esac
 done
+shift $((OPTIND - 1))
+
+if [ $# -gt 0 ]; then
+    TESTS="$@"
+else
+    TESTS=`find $TEST_DIR -type f -name "$TEST_PREFIX*" | sort`
+fi
+
+# Every test writes its output, errors and time to its own files here, so
+# tests can run side by side
+WORK_DIR=`mktemp -d`
+trap 'rm -rf "$WORK_DIR"' EXIT
 
-for F in `find $TEST_DIR -type f -name test_'*' | sort`
+run_test() {
+    local F=$1
+    local OUT=$WORK_DIR/`basename $F`
+    local START=`date +%s%N`
+
+    $BUDDY -i $F > $OUT.out 2> $OUT.err
+
+    local END=`date +%s%N`
+    echo $(( (END - START) / 1000000 )) > $OUT.ms
+}
+
+for F in $TESTS
 do
-    echo "-----------------------------------------------------------"
-    echo "Running test file:    $F"
+    # Keep at most JOBS tests running
+    while [ `jobs -rp | wc -l` -ge $JOBS ]; do
+        wait -n
+    done
+    run_test $F &
+done
+wait
 
-    ./buddy -i $F > $TMP_FILE
+for F in $TESTS
+do
+    OUT=$WORK_DIR/`basename $F`
+    RESULT_FILE=`dirname $F`/`basename $F | sed "s/^$TEST_PREFIX/$RESULT_PREFIX/"`
 
-    RESULT_FILE=`echo $F | sed "s/$TEST_PREFIX/$RESULT_PREFIX/g"`
+    echo "-----------------------------------------------------------"
+    echo "Running test file:    $F (`cat $OUT.ms` ms)"
+
+    if [ "$UPDATE" -eq "1" ]; then
+        cp $OUT.out $RESULT_FILE
+        echo "Updated result file:  $RESULT_FILE"
+        SUCCESSFUL_TESTS+=" $F"
+        echo ""
+        continue
+    fi
 
     echo "Expected result file: $RESULT_FILE"
 
     if [ -e "$RESULT_FILE" ]; then
-        DIFF_OUT=`diff -w $TMP_FILE $RESULT_FILE`
+        DIFF_OUT=`diff -w $OUT.out $RESULT_FILE`
 
         if [ "$DIFF_OUT" != "" ]; then
             echo "Output from test $F differs"
@@ -69,7 +128,9 @@ do
 
             if [ "$VERBOSE" -eq "1" ]; then
                 echo "*** Test output ***"
-                cat $TMP_FILE
+                cat $OUT.out
+                echo "*** Test errors ***"
+                cat $OUT.err
                 echo "*** Expected output ***"
                 cat $RESULT_FILE
                 echo ""
@@ -83,13 +144,11 @@ do
         echo "No result file for test: $F... Skipping diff"
         UNCHECKED_TESTS+=" $F"
         echo "OUTPUT:"
-        cat $TMP_FILE
+        cat $OUT.out
         echo ""
     fi
 done
 
-rm $TMP_FILE
-
 echo "=======================  SUMMARY  ========================="
 echo "SUCCESSFUL TESTS"
 for F in $SUCCESSFUL_TESTS
@@ -112,3 +171,7 @@ do
 done
 
 echo ""
+
+if [ "$FAILED_TESTS" != "" ]; then
+    exit 1
+fi
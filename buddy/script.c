@@ -0,0 +1,263 @@
+/**
+ * Simulator scripts in text and binary form
+ *
+ * See script.h for the formats.
+ */
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "script.h"
+
+/* Sizes are rejected before they can overflow an int64_t */
+#define SIZE_LIMIT (INT64_C(1) << 50)
+
+/* Text names of the first handles, like the classroom samples */
+static const char letters[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+#define NUM_LETTERS ((uint32_t)sizeof(letters) - 1)
+
+
+/**************************************************************************
+ * Local Functions
+ **************************************************************************/
+
+/**
+ * @brief Skip blanks within a line.
+ */
+static inline const char *skip_ws(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+		++p;
+	return p;
+}
+
+
+/**
+ * @brief Match a literal at p, advancing past it on success.
+ */
+static inline bool match(const char **p, const char *end, const char *lit)
+{
+	const char *q = *p;
+
+	while (*lit) {
+		if (q >= end || *q != *lit)
+			return false;
+		++q;
+		++lit;
+	}
+	*p = q;
+	return true;
+}
+
+
+/**
+ * @brief Is c allowed in a variable name.
+ */
+static inline bool is_name_char(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+	       (c >= '0' && c <= '9') || c == '_';
+}
+
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+/**
+ * @brief Parse one text command in a single pass, without copying.
+ *
+ * Blanks are allowed between tokens.  Accepts "X = alloc(N)",
+ * "X = alloc(NK)", "free(X)" and blank lines.
+ */
+int script_parse_line(const char *line, const char *end, script_cmd_t *cmd)
+{
+	const char *p = skip_ws(line, end);
+	const char *name;
+
+	cmd->op = SCRIPT_NONE;
+	cmd->size = 0;
+	if (p == end)
+		return 0;
+
+	// "free(" is a free, anything else must be an assignment
+	const char *q = p;
+	if (match(&q, end, "free")) {
+		q = skip_ws(q, end);
+		if (match(&q, end, "(")) {
+			p = skip_ws(q, end);
+			name = p;
+			while (p < end && is_name_char(*p))
+				++p;
+			if (p == name)
+				return -1;
+			cmd->name = name;
+			cmd->name_len = p - name;
+
+			p = skip_ws(p, end);
+			if (!match(&p, end, ")") || skip_ws(p, end) != end)
+				return -1;
+
+			cmd->op = SCRIPT_FREE;
+			return 0;
+		}
+	}
+
+	name = p;
+	while (p < end && is_name_char(*p))
+		++p;
+	if (p == name)
+		return -1;
+	cmd->name = name;
+	cmd->name_len = p - name;
+
+	p = skip_ws(p, end);
+	if (!match(&p, end, "="))
+		return -1;
+	p = skip_ws(p, end);
+	if (!match(&p, end, "alloc"))
+		return -1;
+	p = skip_ws(p, end);
+	if (!match(&p, end, "("))
+		return -1;
+	p = skip_ws(p, end);
+
+	bool negative = match(&p, end, "-");
+	int64_t size = 0;
+
+	if (p == end || *p < '0' || *p > '9')
+		return -1;
+	while (p < end && *p >= '0' && *p <= '9') {
+		size = size * 10 + (*p++ - '0');
+		if (size > SIZE_LIMIT)
+			return -1;
+	}
+
+	p = skip_ws(p, end);
+	int shift = 0;
+	if (match(&p, end, "K") || match(&p, end, "k"))
+		shift = 10;
+	else if (match(&p, end, "M") || match(&p, end, "m"))
+		shift = 20;
+	else if (match(&p, end, "G") || match(&p, end, "g"))
+		shift = 30;
+	if (size > SIZE_LIMIT >> shift)
+		return -1;
+	size <<= shift;
+	p = skip_ws(p, end);
+	if (!match(&p, end, ")") || skip_ws(p, end) != end)
+		return -1;
+
+	cmd->op = SCRIPT_ALLOC;
+	cmd->size = negative ? -size : size;
+	return 0;
+}
+
+
+/**
+ * @brief Write the text name of a handle.
+ */
+void script_print_name(FILE *out, uint32_t handle)
+{
+	if (handle < NUM_LETTERS)
+		fputc(letters[handle], out);
+	else
+		fprintf(out, "h%" PRIu32, handle);
+}
+
+
+/**
+ * @brief Write one text command, with sizes in K where they divide evenly.
+ */
+void script_print_cmd(FILE *out, script_op_t op, uint32_t handle, int64_t size)
+{
+	if (op == SCRIPT_FREE) {
+		fputs("free(", out);
+		script_print_name(out, handle);
+		fputs(")\n", out);
+		return;
+	}
+
+	script_print_name(out, handle);
+	if (size != 0 && size % 1024 == 0)
+		fprintf(out, " = alloc(%" PRId64 "K)\n", size / 1024);
+	else
+		fprintf(out, " = alloc(%" PRId64 ")\n", size);
+}
+
+
+/**
+ * @brief Write a blank header, to be filled in by script_write_end.
+ *
+ * @return 0 on success, -1 on I/O error
+ */
+int script_write_begin(FILE *out)
+{
+	script_hdr_t hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	return fwrite(&hdr, sizeof(hdr), 1, out) == 1 ? 0 : -1;
+}
+
+
+/**
+ * @brief Write one binary record.
+ *
+ * @return 0 on success, -1 on I/O error
+ */
+int script_write_rec(FILE *out, script_op_t op, uint32_t handle, int64_t size)
+{
+	script_rec_t rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.op = (uint8_t)op;
+	rec.handle = handle;
+	rec.size = size;
+	return fwrite(&rec, sizeof(rec), 1, out) == 1 ? 0 : -1;
+}
+
+
+/**
+ * @brief Rewrite the header at the start of the stream.
+ *
+ * @return 0 on success, -1 on I/O error or if the stream cannot seek
+ */
+int script_write_end(FILE *out, uint64_t count, uint32_t handles)
+{
+	script_hdr_t hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SCRIPT_MAGIC, sizeof(hdr.magic));
+	hdr.version = SCRIPT_VERSION;
+	hdr.rec_size = sizeof(script_rec_t);
+	hdr.count = count;
+	hdr.handles = handles;
+
+	if (fseek(out, 0, SEEK_SET) != 0 || fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+		return -1;
+	return fseek(out, 0, SEEK_END);
+}
+
+
+/**
+ * @brief Check for a supported binary script header.
+ */
+int script_is_binary(const void *buf, size_t len)
+{
+	const script_hdr_t *hdr = buf;
+
+	if (len < sizeof(hdr->magic) ||
+	    memcmp(hdr->magic, SCRIPT_MAGIC, sizeof(hdr->magic)) != 0)
+		return 0;
+
+	if (len < sizeof(*hdr) || hdr->version != SCRIPT_VERSION ||
+	    hdr->rec_size != sizeof(script_rec_t) ||
+	    (len - sizeof(*hdr)) / sizeof(script_rec_t) < hdr->count)
+		return -1;
+
+	return 1;
+}
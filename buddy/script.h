@@ -0,0 +1,101 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+/*
+ * Simulator scripts in text and binary form.
+ *
+ * The text form is what test-files/ holds, one command per line:
+ *
+ *     A = alloc(80K)
+ *     free(A)
+ *
+ * Sizes are in bytes, or in KiB, MiB or GiB with a K, M or G suffix.
+ *
+ * The binary form is meant for captured traces with millions of commands.
+ * It is a script_hdr_t followed by fixed-width script_rec_t records, in host
+ * byte order, which the simulator walks in place through mmap.  Variables
+ * are numbered handles instead of names, so a trace is limited only by the
+ * 32-bit handle space.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Script commands
+ */
+typedef enum script_op_t {
+	SCRIPT_NONE = 0,	///< Blank line
+	SCRIPT_ALLOC,		///< handle = alloc(size)
+	SCRIPT_FREE		///< free(handle)
+} script_op_t;
+
+/**
+ * @type script_cmd_t
+ *
+ * @details One parsed text command.  name points into the parsed line.
+ */
+typedef struct script_cmd_t {
+	script_op_t op;
+	const char *name;	///< Variable name, not NUL terminated
+	int name_len;
+	int64_t size;		///< Bytes requested by an alloc
+} script_cmd_t;
+
+/**
+ * @type script_hdr_t
+ *
+ * @details Header of a binary script.
+ */
+typedef struct script_hdr_t {
+	char magic[8];		///< SCRIPT_MAGIC
+	uint32_t version;	///< SCRIPT_VERSION
+	uint32_t rec_size;	///< sizeof(script_rec_t)
+	uint64_t count;		///< Records following the header
+	uint32_t handles;	///< One more than the largest handle used
+	uint32_t reserved;	///< Zero
+} script_hdr_t;
+
+/**
+ * @type script_rec_t
+ *
+ * @details One binary command.
+ */
+typedef struct script_rec_t {
+	uint8_t op;		///< One of script_op_t
+	uint8_t pad[3];		///< Zero
+	uint32_t handle;	///< Variable the command applies to
+	int64_t size;		///< Bytes requested by an alloc, 0 for a free
+} script_rec_t;
+
+#define SCRIPT_MAGIC "BDYSCRPT"
+#define SCRIPT_VERSION 1
+
+// Parse one text line (without its newline). Returns 0 on success, -1 on a
+// malformed command.
+int script_parse_line(const char *line, const char *end, script_cmd_t *cmd);
+
+// Write the text name of a handle: A-Z and a-z for the first 52 handles,
+// then h52, h53, ...
+void script_print_name(FILE *out, uint32_t handle);
+
+// Write one text command
+void script_print_cmd(FILE *out, script_op_t op, uint32_t handle, int64_t size);
+
+// Reserve room for the header at the start of a binary script
+int script_write_begin(FILE *out);
+
+// Write one binary record
+int script_write_rec(FILE *out, script_op_t op, uint32_t handle, int64_t size);
+
+// Go back and fill in the header once all records are written. The stream
+// must be seekable.
+int script_write_end(FILE *out, uint64_t count, uint32_t handles);
+
+// Validate a binary script header in a buffer of len bytes.  Returns 1 if
+// it is a usable binary script, 0 if it does not look like one, and -1 if
+// it is one but of an unsupported version or truncated.
+int script_is_binary(const void *buf, size_t len);
+
+#endif // SCRIPT_H
@@ -1,13 +1,24 @@
 #include <assert.h>
-#include <errno.h>
 #include <getopt.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "buddy.h"
+#include "buddy_latency.h"
+#include "buddy_trace.h"
+#include "script.h"
+#include "symtab.h"
 
 /**
  * Various program statuses indicating success or failure of an operation
@@ -34,27 +45,226 @@ typedef enum severity_t {
 typedef struct var_t {
 	void* mem;   ///< A pointer to a memory block
 	bool in_use; ///< Is this variable currently in use? This is probably redundant if we assume variables not in use are NULL. For now just leave it as it is
+	bool failed; ///< Its last allocation failed and was let through by -k
+	int64_t size; ///< Bytes requested for the block
 } var_t;
 
+/**
+ * Allocation failures let through by -k, accounted by requested order
+ */
+typedef struct fail_stats_t {
+	long allocs;                 ///< Allocations attempted
+	int64_t live;                ///< Requested bytes currently allocated
+	int64_t peak_live;           ///< Most requested bytes ever allocated at once
+	struct {
+		long count;
+		int64_t min_size;
+		int64_t max_size;
+		double live_sum;     ///< Block bytes in use at each failure, summed
+		int64_t live_max;
+		double frag_sum;     ///< External fragmentation at each failure, summed
+		double frag_max;
+	} order[MAX_ORDER + 2];      ///< The last entry holds impossible sizes
+} fail_stats_t;
+
+/**
+ * The variables of one script, by name
+ */
+typedef struct var_table_t {
+	symtab_t *names;     ///< Variable name to index in vars
+	var_t *vars;         ///< Keep track of variable allocations
+	unsigned long cap;   ///< Room in vars
+} var_table_t;
+
+/**
+ * One replay thread and what it measured
+ */
+typedef struct replay_thread_t {
+	pthread_t tid;
+	int index;
+	const char *map;     ///< Mapped script, shared between threads splitting it
+	size_t len;
+	bool binary;
+	int part;            ///< Only replay variables in this part...
+	int parts;           ///< ...of this many
+	long dump_every;
+	var_table_t table;   ///< Variables of a text script
+	long ops;
+	struct timespec start;
+	struct timespec end;
+	double secs;
+	long contended;      ///< Lock acquisitions that had to wait
+	double wait_secs;    ///< Time spent waiting for the lock
+	status_t status;
+	long fault_line;     ///< Line or record of the fault
+	char fault_cmd[128]; ///< Command that faulted
+} replay_thread_t;
+
+
+static FILE *in = NULL;             // Input file
+static var_table_t table;           // Variables of the script
+static int linenum = 0;             // Line number in input file
+static bool keep_going = false;     // Let allocation failures through (-k)
+static fail_stats_t stats;          // Accounting for -k
 
-static FILE *in = NULL;    // Input file
-static var_t var_map[256]; // Keep track of variable allocations
-static int linenum = 0;    // Line number in input file
+/* Serializes allocator calls between replay threads */
+static pthread_mutex_t buddy_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t start_line;
+static atomic_bool stop_replay = false;
 
 
 /**
  * Resolve a variable by name
  *
- * @param var Name of variable
+ * Any run of letters, digits and underscores names a variable. Names are
+ * interned to dense ids which index vars, so lookups cost one hash probe
+ * however many variables a script uses.
+ *
+ * @param t Table to look the name up in
+ * @param name Name of variable, need not be NUL terminated
+ * @param len Length of the name
  * @return Returns a pointer to location of the variable's
- * representation. Returns NULL if the var is not an alphabetic character.
+ * representation. The pointer is only valid until the next call. Returns
+ * NULL if out of memory.
  */
-static var_t* get_var(char var)
+static var_t* get_var(var_table_t* t, const char* name, int len)
 {
-	if ((var >= 'a' && var <= 'z') || (var >= 'A' && var <= 'Z'))
-		return &var_map[(int) var];
-	else
+	long id = symtab_intern(t->names, name, len);
+
+	if (id < 0)
 		return NULL;
+
+	if ((unsigned long)id >= t->cap) {
+		unsigned long cap = t->cap ? t->cap * 2 : 1024;
+		var_t* grown = realloc(t->vars, cap * sizeof(var_t));
+
+		if (grown == NULL)
+			return NULL;
+		memset(grown + t->cap, 0, (cap - t->cap) * sizeof(var_t));
+		t->vars = grown;
+		t->cap = cap;
+	}
+
+	return &t->vars[id];
+}
+
+/**
+ * Convert a script size to what buddy_alloc takes
+ *
+ * @param size Requested size in bytes
+ * @return size, or SIZE_MAX for a negative size, which buddy_alloc rejects
+ * like any other impossible request
+ */
+static inline size_t alloc_size(int64_t size)
+{
+	return size < 0 ? SIZE_MAX : (size_t)size;
+}
+
+/**
+ * Order of the block buddy_alloc would hand out for a size
+ *
+ * @param size Requested size in bytes
+ * @return The order, or MAX_ORDER + 1 for a size no block can hold
+ */
+static int size_order(int64_t size)
+{
+	int order = MIN_ORDER;
+
+	if (size <= 0 || size > ((int64_t)1 << MAX_ORDER))
+		return MAX_ORDER + 1;
+	while (((int64_t)1 << order) < size)
+		++order;
+	return order;
+}
+
+/**
+ * Account a live allocation
+ *
+ * @param var Variable the block was bound to
+ * @param size Requested size in bytes
+ */
+static inline void note_alloc(var_t* var, int64_t size)
+{
+	var->size = size;
+	stats.live += size;
+	if (stats.live > stats.peak_live)
+		stats.peak_live = stats.live;
+}
+
+/**
+ * Account an allocation failure, with the state of the pool at that moment
+ *
+ * Fragmentation is external fragmentation: the share of free memory that
+ * lies outside the largest free block.
+ *
+ * @param size Requested size in bytes
+ */
+static void note_failure(int64_t size)
+{
+	int o = size_order(size);
+	int64_t free_bytes = 0;
+	int64_t largest = 0;
+	int i;
+
+	for (i = MIN_ORDER; i <= MAX_ORDER; ++i) {
+		int64_t n = buddy_free_count(i);
+		free_bytes += n << i;
+		if (n > 0)
+			largest = (int64_t)1 << i;
+	}
+
+	int64_t used = ((int64_t)1 << MAX_ORDER) - free_bytes;
+	double frag = free_bytes ? 1.0 - (double)largest / free_bytes : 0.0;
+
+	if (stats.order[o].count == 0 || size < stats.order[o].min_size)
+		stats.order[o].min_size = size;
+	if (stats.order[o].count == 0 || size > stats.order[o].max_size)
+		stats.order[o].max_size = size;
+	stats.order[o].count++;
+	stats.order[o].live_sum += used;
+	if (used > stats.order[o].live_max)
+		stats.order[o].live_max = used;
+	stats.order[o].frag_sum += frag;
+	if (frag > stats.order[o].frag_max)
+		stats.order[o].frag_max = frag;
+}
+
+/**
+ * Print the -k summary
+ *
+ * @param out File stream to write to
+ */
+static void print_failures(FILE* out)
+{
+	long failures = 0;
+	int o;
+
+	for (o = MIN_ORDER; o <= MAX_ORDER + 1; ++o)
+		failures += stats.order[o].count;
+
+	fprintf(out, "Allocation failures: %ld of %ld allocations (%.2f%%)\n", failures,
+		stats.allocs, stats.allocs ? 100.0 * failures / stats.allocs : 0.0);
+	fprintf(out, "Peak live bytes: %lld requested\n", (long long)stats.peak_live);
+	if (failures == 0)
+		return;
+
+	fprintf(out, "%7s %9s %10s %10s %12s %12s %9s %9s\n", "order", "failures",
+		"min size", "max size", "avg in use", "max in use", "avg frag", "max frag");
+	for (o = MIN_ORDER; o <= MAX_ORDER + 1; ++o) {
+		long n = stats.order[o].count;
+		char name[8];
+
+		if (n == 0)
+			continue;
+		if (o > MAX_ORDER)
+			snprintf(name, sizeof(name), "invalid");
+		else
+			snprintf(name, sizeof(name), "%d", o);
+		fprintf(out, "%7s %9ld %10lld %10lld %12.0f %12lld %8.1f%% %8.1f%%\n", name, n,
+			(long long)stats.order[o].min_size, (long long)stats.order[o].max_size,
+			stats.order[o].live_sum / n, (long long)stats.order[o].live_max,
+			100.0 * stats.order[o].frag_sum / n, 100.0 * stats.order[o].frag_max);
+	}
 }
 
 /**
@@ -79,6 +289,8 @@ static void print_fault(const char* cmd, const char* msg, severity_t sev)
 		severity_msg = "?????";
 	}
 
+	// Keep faults next to the dumps before them on a terminal
+	buddy_dump_flush();
 	fprintf(stderr, "%s: Line %d: %s\n", severity_msg, linenum, msg);
 	fprintf(stderr, "    Faulting Command: %s\n", cmd);
 }
@@ -96,82 +308,51 @@ static status_t parse_error(const char* cmd)
 }
 
 /**
- * Parses an allocation instruction
+ * Allocate memory for a variable
  *
- * @param cmd String representing an allocation command in the program
- * @returns Status of read and execute
+ * @param var Variable to bind the block to
+ * @param size Requested size in bytes
+ * @param cmd The command being executed, for error messages
+ * @returns Status of the allocation
  */
-static status_t parse_alloc(char* cmd)
+static status_t exec_alloc(var_t* var, int64_t size, const char* cmd)
 {
-	assert(cmd != NULL);
-	assert(cmd[0] != '\0');
-
-	char var_name;
-	int size;
-	char alter_size;
-	int matched;
-
-	errno = 0;
-	matched = sscanf(cmd, "%c=alloc(%d%c)", &var_name, &size, &alter_size);
-
-	// Error check sprintf
-	if (matched == 3 && errno == 0) {
-		// Check what the alter_size variable actually contains
-		switch (alter_size) {
-		case 'k':
-		case 'K':
-			size *= 1024;
-		case ')':
-			break;
-		default:
-			return parse_error(cmd);
-		}
-	}
-	else {
-		return parse_error(cmd);
-	}
-
-	// Resolve variable
-	var_t* var = get_var(var_name);
-
-	if (var == NULL)
-		return parse_error(cmd);
-
 	// Allocate variable
-	var->mem = buddy_alloc(size);
+	var->mem = buddy_alloc(alloc_size(size));
+	stats.allocs++;
 
 	if (var->mem == NULL) {
 		print_fault(cmd, "buddy_alloc returned NULL", WARNING);
 		printf("Out of memory\n");
+		if (keep_going) {
+			note_failure(size);
+			var->in_use = false;
+			var->failed = true;
+		}
 		return OUTOFMEMORY;
 	}
 
 	var->in_use = true;
+	var->failed = false;
+	note_alloc(var, size);
 
 	return SUCCESS;
 }
 
 /**
- * Parses a free instruction
+ * Free the memory held by a variable
  *
- * @param cmd String representing an allocation command in the program
- * @returns Status of read and execute
+ * @param var Variable to release
+ * @param cmd The command being executed, for error messages
+ * @returns Status of the free
  */
-static status_t parse_free(char* cmd)
+static status_t exec_free(var_t* var, const char* cmd)
 {
-	assert(cmd != NULL);
-
-	char var_name;
-	int matched;
-	var_t* var;
-
-	// Read the command string
-	errno = 0;
-	matched = sscanf(cmd, "free(%c)", &var_name);
-
-	// Check if sscanf was valid
-	if (matched != 1 || errno != 0 || (var = get_var(var_name)) == NULL)
-		return parse_error(cmd);
+	// A block that -k let fail to allocate has nothing to free
+	if (var->failed) {
+		var->failed = false;
+		return SUCCESS;
+	}
 
 	// Ensure that the variable is in use
 	if (!var->in_use) {
@@ -183,11 +364,11 @@ static status_t parse_free(char* cmd)
 	buddy_free(var->mem);
 	var->mem = NULL;
 	var->in_use = false;
+	stats.live -= var->size;
 
 	return SUCCESS;
 }
 
-
 /**
  * Simplify the command and call one of the sub parser functions
  *
@@ -218,22 +399,32 @@ static status_t parse_command(char* cmd, int cmd_len)
 			cmd[ws_cursor++] = cmd[i];
 		}
 	}
+	cmd[ws_cursor] = '\0';
 
 	status_t status;
+	script_cmd_t parsed;
+	var_t* var;
 
 	// We have 2 commands: alloc and free.
-	if (strstr(cmd, "alloc") != NULL)
-		status = parse_alloc(cmd);
-	else if (strstr(cmd, "free") != NULL)
-		status = parse_free(cmd);
-	else
+	if (script_parse_line(cmd, cmd + ws_cursor, &parsed) != 0)
 		return parse_error(cmd);
 
+	if (parsed.op == SCRIPT_NONE)
+		return SUCCESS;
+
+	if ((var = get_var(&table, parsed.name, parsed.name_len)) == NULL)
+		return parse_error(cmd);
+
+	if (parsed.op == SCRIPT_ALLOC)
+		status = exec_alloc(var, parsed.size, cmd);
+	else
+		status = exec_free(var, cmd);
+
 	if (status != SUCCESS)
 		return status;
 
 	// Output free blocks
-	buddy_dump();
+	buddy_dump_buffered();
 
 	return SUCCESS;
 }
@@ -253,9 +444,551 @@ static status_t parse_file()
 
 	while (status == SUCCESS && (read = getline(&line, &len, in)) > 0) {
 		++linenum;
-		status = parse_command(line, len);
+		status = parse_command(line, read);
+		if (status == OUTOFMEMORY && keep_going)
+			status = SUCCESS;
+	}
+
+	free(line);
+
+	return status;
+}
+
+
+/**
+ * Report a fault for a line that is not NUL terminated
+ *
+ * @param line Start of the line
+ * @param end End of the line
+ * @param status Status to report and hand back
+ * @return status
+ */
+static status_t replay_fault(const char* line, const char* end, status_t status)
+{
+	char cmd[128];
+	int len = end - line < (int)sizeof(cmd) - 1 ? end - line : (int)sizeof(cmd) - 1;
+
+	memcpy(cmd, line, len);
+	cmd[len] = '\0';
+
+	switch (status) {
+	case BADINPUT:
+		return parse_error(cmd);
+	case DOUBLEFREE:
+		print_fault(cmd, "Double free", ERROR);
+		break;
+	case OUTOFMEMORY:
+		print_fault(cmd, "buddy_alloc returned NULL", WARNING);
+		printf("Out of memory\n");
+		break;
+	default:
+		break;
+	}
+	return status;
+}
+
+/**
+ * Run one allocation or free against a variable
+ *
+ * @param var Variable the command applies to
+ * @param op SCRIPT_ALLOC or SCRIPT_FREE
+ * @param size Bytes requested by an alloc
+ * @return SUCCESS, OUTOFMEMORY or DOUBLEFREE. Nothing is printed, and
+ * with -k a failed allocation is accounted and counts as SUCCESS.
+ */
+static inline status_t replay_op(var_t* var, script_op_t op, int64_t size)
+{
+	if (op == SCRIPT_FREE) {
+		if (!var->in_use) {
+			if (!var->failed)
+				return DOUBLEFREE;
+			var->failed = false;
+			return SUCCESS;
+		}
+		buddy_free(var->mem);
+		var->mem = NULL;
+		var->in_use = false;
+		stats.live -= var->size;
+		return SUCCESS;
+	}
+
+	var->mem = buddy_alloc(alloc_size(size));
+	stats.allocs++;
+	if (var->mem == NULL) {
+		if (!keep_going)
+			return OUTOFMEMORY;
+		note_failure(size);
+		var->in_use = false;
+		var->failed = true;
+		return SUCCESS;
+	}
+	var->in_use = true;
+	var->failed = false;
+	note_alloc(var, size);
+	return SUCCESS;
+}
+
+/**
+ * Replay a text script held in memory
+ *
+ * @param p Start of the script
+ * @param end End of the script
+ * @param dump_every Interval between dumps in commands, 0 for none
+ * @param ops Incremented for every command executed
+ * @return Program status.
+ */
+static status_t replay_text(const char* p, const char* end, long dump_every, long* ops)
+{
+	status_t status = SUCCESS;
+	script_cmd_t cmd;
+	var_t* var;
+
+	while (status == SUCCESS && p < end) {
+		const char* eol = memchr(p, '\n', end - p);
+
+		if (eol == NULL)
+			eol = end;
+		++linenum;
+
+		if (script_parse_line(p, eol, &cmd) != 0 ||
+		    (cmd.op != SCRIPT_NONE && (var = get_var(&table, cmd.name, cmd.name_len)) == NULL)) {
+			return replay_fault(p, eol, BADINPUT);
+		}
+
+		if (cmd.op != SCRIPT_NONE) {
+			status = replay_op(var, cmd.op, cmd.size);
+			if (status != SUCCESS)
+				return replay_fault(p, eol, status);
+
+			++*ops;
+			if (dump_every > 0 && *ops % dump_every == 0)
+				buddy_dump_buffered();
+		}
+		p = eol + 1;
+	}
+
+	return status;
+}
+
+/**
+ * Replay a binary script in place
+ *
+ * Handles index a dense array of variables sized from the header.
+ *
+ * @param map Mapped script, header included
+ * @param dump_every Interval between dumps in commands, 0 for none
+ * @param ops Incremented for every command executed
+ * @return Program status.
+ */
+static status_t replay_binary(const char* map, long dump_every, long* ops)
+{
+	const script_hdr_t* hdr = (const script_hdr_t*)map;
+	const script_rec_t* rec = (const script_rec_t*)(hdr + 1);
+	const script_rec_t* end = rec + hdr->count;
+	status_t status = SUCCESS;
+	char cmd[64];
+
+	var_t* vars = calloc(hdr->handles ? hdr->handles : 1, sizeof(var_t));
+	if (vars == NULL) {
+		fprintf(stderr, "ERROR: Out of memory for %u handles\n", hdr->handles);
+		return BADINPUT;
+	}
+
+	for (; rec < end; ++rec) {
+		// Records stand in for lines in error messages
+		++linenum;
+
+		if (rec->handle >= hdr->handles ||
+		    (rec->op != SCRIPT_ALLOC && rec->op != SCRIPT_FREE)) {
+			snprintf(cmd, sizeof(cmd), "record op %u handle %u", rec->op, rec->handle);
+			status = parse_error(cmd);
+			break;
+		}
+
+		status = replay_op(&vars[rec->handle], rec->op, rec->size);
+		if (status != SUCCESS) {
+			if (rec->op == SCRIPT_FREE)
+				snprintf(cmd, sizeof(cmd), "free(h%u)", rec->handle);
+			else
+				snprintf(cmd, sizeof(cmd), "h%u = alloc(%lld)", rec->handle,
+					 (long long)rec->size);
+			replay_fault(cmd, cmd + strlen(cmd), status);
+			break;
+		}
+
+		++*ops;
+		if (dump_every > 0 && *ops % dump_every == 0)
+			buddy_dump_buffered();
+	}
+
+	free(vars);
+	return status;
+}
+
+/**
+ * Map a script file for replay
+ *
+ * @param path Script file to map
+ * @param map Set to the mapping, or NULL for an empty file
+ * @param len Set to the length of the file
+ * @param binary Set if the file is a binary script
+ * @return Program status.
+ */
+static status_t map_script(const char* path, const char** map, size_t* len, bool* binary)
+{
+	struct stat st;
+	int fd;
+
+	*map = NULL;
+	*len = 0;
+	*binary = false;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		perror("ERROR: Failed to open input file.");
+		return BADINPUT;
+	}
+
+	if (st.st_size == 0) {
+		close(fd);
+		return SUCCESS;
+	}
+
+	*map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (*map == MAP_FAILED) {
+		*map = NULL;
+		perror("ERROR: Failed to map input file.");
+		return BADINPUT;
+	}
+	*len = st.st_size;
+	madvise((void*)*map, *len, MADV_SEQUENTIAL);
+
+	int kind = script_is_binary(*map, *len);
+	if (kind < 0) {
+		fprintf(stderr, "ERROR: Unsupported or truncated binary script\n");
+		munmap((void*)*map, *len);
+		*map = NULL;
+		return BADINPUT;
+	}
+	*binary = kind == 1;
+
+	return SUCCESS;
+}
+
+/**
+ * Seconds between two readings of CLOCK_MONOTONIC
+ */
+static inline double elapsed(const struct timespec* t0, const struct timespec* t1)
+{
+	return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/**
+ * Replay a script file as fast as possible
+ *
+ * The file is mapped rather than read and walked in a single pass without
+ * copying; binary scripts (see script.h) are recognized by their header.
+ * buddy_dump only runs every dump_every commands (never if 0).  The replay
+ * time and rate are reported on standard error.
+ *
+ * @param path Script file to replay
+ * @param dump_every Interval between dumps in commands, 0 for none
+ * @return Program status.
+ */
+static status_t replay_file(const char* path, long dump_every)
+{
+	struct timespec t0, t1;
+	status_t status;
+	const char* map;
+	size_t len;
+	bool binary;
+	long ops = 0;
+
+	status = map_script(path, &map, &len, &binary);
+	if (status != SUCCESS || map == NULL)
+		return status;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	if (binary)
+		status = replay_binary(map, dump_every, &ops);
+	else
+		status = replay_text(map, map + len, dump_every, &ops);
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	munmap((void*)map, len);
+
+	double secs = elapsed(&t0, &t1);
+	fprintf(stderr, "Replayed %ld operations in %.6f s (%.0f ops/s)\n",
+		ops, secs, secs > 0 ? ops / secs : 0.0);
+
+	return status;
+}
+
+
+/**
+ * Run one command with the allocator lock held
+ *
+ * The lock is tried first so that only acquisitions which actually had to
+ * wait are timed and counted as contended.
+ *
+ * @param t Calling thread, for its contention counts
+ * @param var Variable the command applies to
+ * @param op SCRIPT_ALLOC or SCRIPT_FREE
+ * @param size Bytes requested by an alloc
+ * @return As replay_op.
+ */
+static inline status_t locked_op(replay_thread_t* t, var_t* var, script_op_t op, int64_t size)
+{
+	status_t status;
+
+	if (pthread_mutex_trylock(&buddy_lock) != 0) {
+		struct timespec w0, w1;
+
+		clock_gettime(CLOCK_MONOTONIC, &w0);
+		pthread_mutex_lock(&buddy_lock);
+		clock_gettime(CLOCK_MONOTONIC, &w1);
+		t->contended++;
+		t->wait_secs += elapsed(&w0, &w1);
 	}
 
+	status = replay_op(var, op, size);
+	if (status == SUCCESS && t->dump_every > 0 && (t->ops + 1) % t->dump_every == 0)
+		buddy_dump_buffered();
+
+	pthread_mutex_unlock(&buddy_lock);
+	return status;
+}
+
+/**
+ * Thread body: replay this thread's share of a text script
+ */
+static void replay_thread_text(replay_thread_t* t)
+{
+	const char* p = t->map;
+	const char* end = t->map + t->len;
+	script_cmd_t cmd;
+	long line = 0;
+
+	while (p < end && !stop_replay) {
+		const char* eol = memchr(p, '\n', end - p);
+		var_t* var = NULL;
+
+		if (eol == NULL)
+			eol = end;
+		++line;
+
+		if (script_parse_line(p, eol, &cmd) != 0) {
+			t->status = BADINPUT;
+		}
+		else if (cmd.op != SCRIPT_NONE &&
+			 symtab_hash(cmd.name, cmd.name_len) % t->parts == (uint32_t)t->part) {
+			var = get_var(&t->table, cmd.name, cmd.name_len);
+			t->status = var ? locked_op(t, var, cmd.op, cmd.size) : BADINPUT;
+		}
+
+		if (t->status != SUCCESS) {
+			int n = eol - p < (int)sizeof(t->fault_cmd) - 1 ? eol - p
+				: (int)sizeof(t->fault_cmd) - 1;
+			memcpy(t->fault_cmd, p, n);
+			t->fault_cmd[n] = '\0';
+			t->fault_line = line;
+			return;
+		}
+		if (var != NULL)
+			t->ops++;
+		p = eol + 1;
+	}
+}
+
+/**
+ * Thread body: replay this thread's share of a binary script
+ */
+static void replay_thread_binary(replay_thread_t* t)
+{
+	const script_hdr_t* hdr = (const script_hdr_t*)t->map;
+	const script_rec_t* first = (const script_rec_t*)(hdr + 1);
+	const script_rec_t* rec;
+
+	var_t* vars = calloc(hdr->handles ? hdr->handles : 1, sizeof(var_t));
+	if (vars == NULL) {
+		t->status = BADINPUT;
+		snprintf(t->fault_cmd, sizeof(t->fault_cmd), "out of memory for %u handles",
+			 hdr->handles);
+		return;
+	}
+
+	for (rec = first; rec < first + hdr->count && !stop_replay; ++rec) {
+		if (rec->handle >= hdr->handles ||
+		    (rec->op != SCRIPT_ALLOC && rec->op != SCRIPT_FREE)) {
+			t->status = BADINPUT;
+			snprintf(t->fault_cmd, sizeof(t->fault_cmd), "record op %u handle %u",
+				 rec->op, rec->handle);
+		}
+		else if (rec->handle % t->parts == (uint32_t)t->part) {
+			t->status = locked_op(t, &vars[rec->handle], rec->op, rec->size);
+			if (t->status == SUCCESS) {
+				t->ops++;
+				continue;
+			}
+			if (rec->op == SCRIPT_FREE)
+				snprintf(t->fault_cmd, sizeof(t->fault_cmd), "free(h%u)", rec->handle);
+			else
+				snprintf(t->fault_cmd, sizeof(t->fault_cmd), "h%u = alloc(%lld)",
+					 rec->handle, (long long)rec->size);
+		}
+		else {
+			continue;
+		}
+
+		t->fault_line = rec - first + 1;
+		break;
+	}
+
+	free(vars);
+}
+
+/**
+ * Thread entry point
+ */
+static void* replay_thread(void* arg)
+{
+	replay_thread_t* t = arg;
+
+	pthread_barrier_wait(&start_line);
+	clock_gettime(CLOCK_MONOTONIC, &t->start);
+
+	if (t->binary)
+		replay_thread_binary(t);
+	else
+		replay_thread_text(t);
+
+	clock_gettime(CLOCK_MONOTONIC, &t->end);
+	t->secs = elapsed(&t->start, &t->end);
+
+	// One failure ends the run, as it does for a serial replay
+	if (t->status != SUCCESS)
+		stop_replay = true;
+
+	return NULL;
+}
+
+/**
+ * Replay scripts on several threads against the one allocator
+ *
+ * With several paths, each thread replays its own script.  With one path,
+ * the script is split by variable across nthreads threads, so every
+ * variable's commands still run in order on a single thread.  Allocator
+ * calls are serialized by a mutex; per-thread throughput and how often and
+ * how long each thread waited for the lock are reported on standard error.
+ *
+ * @param paths Script files to replay
+ * @param npaths Number of paths
+ * @param nthreads Threads to split a single script across
+ * @param dump_every Interval between dumps in each thread's commands, 0 for none
+ * @return Program status.
+ */
+static status_t replay_threads(char** paths, int npaths, int nthreads, long dump_every)
+{
+	status_t status = SUCCESS;
+	long ops = 0;
+	int i;
+
+	if (npaths > 1)
+		nthreads = npaths;
+
+	replay_thread_t* threads = calloc(nthreads, sizeof(replay_thread_t));
+	if (threads == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		return BADINPUT;
+	}
+
+	for (i = 0; i < nthreads && status == SUCCESS; i++) {
+		replay_thread_t* t = &threads[i];
+
+		t->index = i;
+		t->dump_every = dump_every;
+		if (npaths > 1 || i == 0) {
+			t->part = 0;
+			t->parts = 1;
+			status = map_script(paths[npaths > 1 ? i : 0], &t->map, &t->len, &t->binary);
+		}
+		else {
+			t->map = threads[0].map;
+			t->len = threads[0].len;
+			t->binary = threads[0].binary;
+		}
+		if (npaths == 1) {
+			t->part = i;
+			t->parts = nthreads;
+		}
+		t->table.names = symtab_create(1024);
+		if (t->table.names == NULL) {
+			fprintf(stderr, "ERROR: Out of memory\n");
+			status = BADINPUT;
+		}
+	}
+
+	pthread_barrier_init(&start_line, NULL, nthreads + 1);
+	for (i = 0; i < nthreads && status == SUCCESS; i++) {
+		if (pthread_create(&threads[i].tid, NULL, replay_thread, &threads[i]) != 0) {
+			perror("ERROR: Failed to start replay thread.");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (status == SUCCESS) {
+		pthread_barrier_wait(&start_line);
+		for (i = 0; i < nthreads; i++)
+			pthread_join(threads[i].tid, NULL);
+
+		// Wall time runs from the first thread starting to the last finishing
+		struct timespec* first = &threads[0].start;
+		struct timespec* last = &threads[0].end;
+
+		for (i = 0; i < nthreads; i++) {
+			replay_thread_t* t = &threads[i];
+
+			if (elapsed(&t->start, first) > 0)
+				first = &t->start;
+			if (elapsed(last, &t->end) > 0)
+				last = &t->end;
+
+			fprintf(stderr, "Thread %d: %ld operations in %.6f s (%.0f ops/s), "
+				"%ld contended (%.1f%%), %.6f s waiting\n",
+				t->index, t->ops, t->secs, t->secs > 0 ? t->ops / t->secs : 0.0,
+				t->contended, t->ops ? 100.0 * t->contended / t->ops : 0.0,
+				t->wait_secs);
+			ops += t->ops;
+		}
+
+		double secs = elapsed(first, last);
+		fprintf(stderr, "Replayed %ld operations on %d threads in %.6f s (%.0f ops/s)\n",
+			ops, nthreads, secs, secs > 0 ? ops / secs : 0.0);
+
+		// Report the first failure the way a serial replay would
+		for (i = 0; i < nthreads; i++) {
+			replay_thread_t* t = &threads[i];
+			if (t->status != SUCCESS) {
+				linenum = t->fault_line;
+				status = replay_fault(t->fault_cmd, t->fault_cmd + strlen(t->fault_cmd),
+						      t->status);
+				break;
+			}
+		}
+	}
+	pthread_barrier_destroy(&start_line);
+
+	for (i = 0; i < nthreads; i++) {
+		replay_thread_t* t = &threads[i];
+		if (t->map != NULL && (npaths > 1 || i == 0))
+			munmap((void*)t->map, t->len);
+		symtab_destroy(t->table.names);
+		free(t->table.vars);
+	}
+	free(threads);
+
 	return status;
 }
 
@@ -269,29 +1002,89 @@ static status_t parse_file()
 void print_usage(char* prog_name, FILE* out)
 {
 	fprintf(out, "Usage:\n");
-	fprintf(out, "  ./%s [-i filename]\n", prog_name);
+	fprintf(out, "  ./%s [-i filename] [-t tracefile] [-l] [-k] [-r [-d interval] [-j threads]]\n", prog_name);
 	fprintf(out, "     -i [optional] - Specify an input file name to read from. If this option \n");
 	fprintf(out, "                     is not used then input is expected from standard input.\n");
+	fprintf(out, "     -t [optional] - Record every allocator call and write the binary trace\n");
+	fprintf(out, "                     to this file on exit. Decode it with trace_decode.\n");
+	fprintf(out, "     -l [optional] - Print alloc/free latency percentiles to standard error\n");
+	fprintf(out, "                     on exit. Requires a build with USE_LATENCY.\n");
+	fprintf(out, "     -k [optional] - Keep going past allocation failures, and print a summary\n");
+	fprintf(out, "                     of them by order on standard error on exit.\n");
+	fprintf(out, "     -r [optional] - Replay mode for large traces: map the input file, parse\n");
+	fprintf(out, "                     it in one pass and report replay time and ops/s on\n");
+	fprintf(out, "                     standard error. Accepts text or binary scripts (see\n");
+	fprintf(out, "                     trace_conv). Requires -i.\n");
+	fprintf(out, "     -d [optional] - In replay mode, dump free blocks every this many\n");
+	fprintf(out, "                     commands. The default of 0 never dumps.\n");
+	fprintf(out, "     -j [optional] - In replay mode, split the script by variable across this\n");
+	fprintf(out, "                     many threads sharing the allocator. Given -i more than\n");
+	fprintf(out, "                     once, replay each script on a thread of its own instead.\n");
+	fprintf(out, "                     Reports per-thread throughput and lock contention.\n");
+	fprintf(out, "  Sizes in scripts take a K, M or G suffix, as in A = alloc(3G).\n");
 }
 
 int main(int argc, char** argv)
 {
 	int opt;
+	FILE *trace_out = NULL;
+	bool print_latency = false;
+	char **in_paths = calloc(argc, sizeof(char *));
+	int num_paths = 0;
+	int num_threads = 0;
+	bool replay = false;
+	long dump_every = 0;
 
 	status_t prog_status;
 
 	in = stdin;
 
 	// Parse command line options
-	while ((opt = getopt(argc, argv, "i:")) != -1) {
+	while ((opt = getopt(argc, argv, "i:t:lkrd:j:")) != -1) {
 		switch (opt) {
 		case 'i':
+			if (in != NULL && in != stdin)
+				fclose(in);
 			in = fopen(optarg, "r");
+			in_paths[num_paths++] = optarg;
+			break;
+
+		case 't':
+			trace_out = fopen(optarg, "wb");
+			if (trace_out == NULL) {
+				perror("ERROR: Failed to open trace file.");
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case 'l':
+			print_latency = true;
+			break;
+
+		case 'k':
+			keep_going = true;
+			break;
+
+		case 'r':
+			replay = true;
+			break;
+
+		case 'd':
+			dump_every = atol(optarg);
+			break;
+
+		case 'j':
+			num_threads = atoi(optarg);
+			if (num_threads < 1) {
+				fprintf(stderr, "ERROR: Need at least one thread\n");
+				return EXIT_FAILURE;
+			}
 			break;
 
 		case '?':
 			switch (optopt) {
 			case 'i':
+			case 't':
 				fprintf(stderr, "ERROR: Missing filename after '%c'", optopt);
 				return EXIT_FAILURE;
 			}
@@ -307,16 +1100,62 @@ int main(int argc, char** argv)
 		return EXIT_FAILURE;
 	}
 
-	// Zero memory
-	memset(var_map, 0, sizeof(var_map));
+	if (replay && num_paths == 0) {
+		fprintf(stderr, "ERROR: Replay mode needs an input file (-i)\n");
+		return EXIT_FAILURE;
+	}
+
+	if ((num_paths > 1 || num_threads > 0) && !replay) {
+		fprintf(stderr, "ERROR: Several inputs or threads need replay mode (-r)\n");
+		return EXIT_FAILURE;
+	}
+
+	if (num_paths > 1 && num_threads > 0 && num_threads != num_paths) {
+		fprintf(stderr, "ERROR: -j must match the number of input files\n");
+		return EXIT_FAILURE;
+	}
+
+	table.names = symtab_create(1024);
+	if (table.names == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		return EXIT_FAILURE;
+	}
 
 	// Execute program
 	buddy_init();
-	prog_status = parse_file();
+
+	if (trace_out != NULL)
+		buddy_trace_start(0);
+
+	if (replay && (num_paths > 1 || num_threads > 0))
+		prog_status = replay_threads(in_paths, num_paths, num_threads, dump_every);
+	else if (replay)
+		prog_status = replay_file(in_paths[0], dump_every);
+	else
+		prog_status = parse_file();
+
+	buddy_dump_flush();
 
 	if (in != stdin)
 		fclose(in);
 
+	if (trace_out != NULL) {
+		buddy_trace_stop();
+		if (buddy_trace_write(trace_out) != 0)
+			perror("ERROR: Failed to write trace file.");
+		fclose(trace_out);
+	}
+
+	if (print_latency)
+		buddy_latency_print(stderr);
+
+	if (keep_going)
+		print_failures(stderr);
+
+	symtab_destroy(table.names);
+	free(table.vars);
+	free(in_paths);
+
 	if (prog_status == SUCCESS)
 		return EXIT_SUCCESS;
 	else
@@ -0,0 +1,220 @@
+/**
+ * Symbol table mapping variable names to dense integer ids
+ *
+ * See symtab.h for an overview.
+ */
+
+/**************************************************************************
+ * Included Files
+ **************************************************************************/
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "symtab.h"
+
+/**************************************************************************
+ * Private Types
+ **************************************************************************/
+
+struct symtab_t {
+	long *slots;		// Id + 1 of the name in each slot, 0 when empty
+	uint32_t *hashes;	// Hash of each id's name, avoids most strcmps
+	char **names;		// Name of each id
+	unsigned long mask;	// Slot count - 1
+	unsigned long count;	// Names interned
+	unsigned long cap;	// Room in names and hashes
+};
+
+
+/**************************************************************************
+ * Local Functions
+ **************************************************************************/
+
+/**
+ * @brief Slot holding the name, or the empty slot where it would go.
+ */
+static unsigned long probe(const symtab_t *tab, const char *name, int len, uint32_t h)
+{
+	unsigned long i = h & tab->mask;
+
+	while (tab->slots[i]) {
+		long id = tab->slots[i] - 1;
+		if (tab->hashes[id] == h && strncmp(tab->names[id], name, len) == 0 &&
+		    tab->names[id][len] == '\0') {
+			break;
+		}
+		i = (i + 1) & tab->mask;
+	}
+	return i;
+}
+
+
+/**
+ * @brief Double the slot array and reinsert every id.
+ */
+static int grow(symtab_t *tab)
+{
+	unsigned long n = (tab->mask + 1) * 2;
+	long *slots = calloc(n, sizeof(long));
+	unsigned long id;
+
+	if (slots == NULL) {
+		return -1;
+	}
+
+	free(tab->slots);
+	tab->slots = slots;
+	tab->mask = n - 1;
+
+	for (id = 0; id < tab->count; id++) {
+		unsigned long i = tab->hashes[id] & tab->mask;
+		while (tab->slots[i]) {
+			i = (i + 1) & tab->mask;
+		}
+		tab->slots[i] = id + 1;
+	}
+	return 0;
+}
+
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+
+/**
+ * @brief FNV-1a over the name.
+ */
+uint32_t symtab_hash(const char *name, int len)
+{
+	uint32_t h = 2166136261u;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)name[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+
+/**
+ * @brief Create an empty table with room for about hint names.
+ */
+symtab_t *symtab_create(unsigned long hint)
+{
+	symtab_t *tab = calloc(1, sizeof(*tab));
+	unsigned long n = 16;
+
+	if (tab == NULL) {
+		return NULL;
+	}
+	while (n < hint * 2) {
+		n <<= 1;
+	}
+
+	tab->slots = calloc(n, sizeof(long));
+	tab->mask = n - 1;
+	if (tab->slots == NULL) {
+		free(tab);
+		return NULL;
+	}
+	return tab;
+}
+
+
+/**
+ * @brief Release a table and its names.
+ */
+void symtab_destroy(symtab_t *tab)
+{
+	unsigned long id;
+
+	if (tab == NULL) {
+		return;
+	}
+	for (id = 0; id < tab->count; id++) {
+		free(tab->names[id]);
+	}
+	free(tab->names);
+	free(tab->hashes);
+	free(tab->slots);
+	free(tab);
+}
+
+
+/**
+ * @brief Id of a name, interning it if it has not been seen.
+ */
+long symtab_intern(symtab_t *tab, const char *name, int len)
+{
+	uint32_t h = symtab_hash(name, len);
+	unsigned long i = probe(tab, name, len, h);
+
+	if (tab->slots[i]) {
+		return tab->slots[i] - 1;
+	}
+
+	if (tab->count == tab->cap) {
+		unsigned long cap = tab->cap ? tab->cap * 2 : 64;
+		char **names = realloc(tab->names, cap * sizeof(char *));
+		if (names == NULL) {
+			return -1;
+		}
+		tab->names = names;
+
+		uint32_t *hashes = realloc(tab->hashes, cap * sizeof(uint32_t));
+		if (hashes == NULL) {
+			return -1;
+		}
+		tab->hashes = hashes;
+		tab->cap = cap;
+	}
+
+	char *copy = malloc(len + 1);
+	if (copy == NULL) {
+		return -1;
+	}
+	memcpy(copy, name, len);
+	copy[len] = '\0';
+
+	long id = tab->count++;
+	tab->names[id] = copy;
+	tab->hashes[id] = h;
+	tab->slots[i] = id + 1;
+
+	// Keep the table at most half full
+	if (tab->count * 2 > tab->mask + 1 && grow(tab) != 0) {
+		return -1;
+	}
+	return id;
+}
+
+
+/**
+ * @brief Id of a name, or -1 if it was never interned.
+ */
+long symtab_find(const symtab_t *tab, const char *name, int len)
+{
+	unsigned long i = probe(tab, name, len, symtab_hash(name, len));
+
+	return tab->slots[i] - 1;
+}
+
+
+/**
+ * @brief Name of an id.
+ */
+const char *symtab_name(const symtab_t *tab, long id)
+{
+	return tab->names[id];
+}
+
+
+/**
+ * @brief Number of interned names.
+ */
+unsigned long symtab_count(const symtab_t *tab)
+{
+	return tab->count;
+}
@@ -0,0 +1,38 @@
+#ifndef SYMTAB_H
+#define SYMTAB_H
+
+/*
+ * Symbol table mapping variable names to dense integer ids.
+ *
+ * Names are interned in first-seen order, so ids run from 0 up to
+ * symtab_count() - 1 and can index a plain array.  Lookups use open
+ * addressing with linear probing over a power-of-two table of ids, kept at
+ * most half full so probe sequences stay short.
+ */
+
+#include <stdint.h>
+
+typedef struct symtab_t symtab_t;
+
+// Create an empty table sized for about hint names
+symtab_t *symtab_create(unsigned long hint);
+
+// Release a table and its names
+void symtab_destroy(symtab_t *tab);
+
+// Id of a name, adding it if it is new. Returns -1 if out of memory.
+long symtab_intern(symtab_t *tab, const char *name, int len);
+
+// Id of a name, or -1 if it has never been interned
+long symtab_find(const symtab_t *tab, const char *name, int len);
+
+// Name of an id, NUL terminated
+const char *symtab_name(const symtab_t *tab, long id);
+
+// Number of interned names
+unsigned long symtab_count(const symtab_t *tab);
+
+// Hash the table uses for a name, for callers that partition names
+uint32_t symtab_hash(const char *name, int len);
+
+#endif // SYMTAB_H
@@ -0,0 +1,115 @@
+/*
+ * Exercises compaction: a heap with every other page in use has no free
+ * block above a page, and moving half the blocks must free a 512K region
+ * with every block's contents and handle intact, whether compaction runs
+ * in small steps or on a failed allocation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "buddy.h"
+#include "test_util.h"
+
+#define PAGE ((size_t)1 << MIN_ORDER)
+#define N_PAGES (((size_t)1 << MAX_ORDER) / PAGE)
+#define BIG_ORDER (MAX_ORDER - 1)
+
+static int *handles[N_PAGES];	// What the program holds, updated on moves
+static int moves;
+static int veto;
+
+static int relocate(void *old_addr, void *new_addr, size_t size, void *arg)
+{
+	int i;
+
+	if (veto)
+		return 1;
+	for (i = 0; i < N_PAGES; i++) {
+		if (handles[i] == old_addr) {
+			handles[i] = new_addr;
+			moves++;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Every page allocated and tagged, then every other one freed.  With pin
+ * set, one block in each half of the heap is not movable.
+ */
+static void fragment(int pin)
+{
+	int i;
+
+	buddy_init();
+	for (i = 0; i < N_PAGES; i++) {
+		if (pin && i % (N_PAGES / 2) == 1)
+			handles[i] = buddy_alloc(PAGE);
+		else
+			handles[i] = buddy_alloc_movable(PAGE);
+		*handles[i] = i;
+	}
+	for (i = 0; i < N_PAGES; i += 2) {
+		buddy_free(handles[i]);
+		handles[i] = NULL;
+	}
+}
+
+static int tags_intact(void)
+{
+	int i;
+
+	for (i = 1; i < N_PAGES; i += 2) {
+		if (handles[i] == NULL || *handles[i] != i)
+			return 0;
+	}
+	return 1;
+}
+
+int main(void)
+{
+	int calls = 0, r;
+	void *big;
+
+	// Nothing moves without a callback
+	fragment(0);
+	EXPECT(buddy_free_count(MIN_ORDER) == N_PAGES / 2);
+	EXPECT(buddy_alloc((size_t)1 << BIG_ORDER) == NULL);
+	EXPECT(buddy_compact(BIG_ORDER, 0) == -1);
+
+	// A vetoed move leaves the heap as it was
+	buddy_set_relocate(relocate, NULL);
+	veto = 1;
+	EXPECT(buddy_compact(BIG_ORDER, 0) == 0);
+	EXPECT(buddy_free_count(MIN_ORDER) == N_PAGES / 2);
+	EXPECT(buddy_check() == 0 && tags_intact());
+	veto = 0;
+
+	// In steps: a 1 ns budget moves one block per call
+	while ((r = buddy_compact(BIG_ORDER, 1)) == 0)
+		calls++;
+	EXPECT(r == 1 && calls > 1);
+	EXPECT(moves == N_PAGES / 4);
+	EXPECT(buddy_check() == 0 && tags_intact());
+	big = buddy_alloc((size_t)1 << BIG_ORDER);
+	EXPECT(big != NULL);
+	buddy_free(big);
+
+	// On a failed allocation
+	fragment(0);
+	buddy_set_relocate(relocate, NULL);
+	big = buddy_alloc((size_t)1 << BIG_ORDER);
+	EXPECT(big != NULL);
+	EXPECT(buddy_check() == 0 && tags_intact());
+
+	// A pinned block in each half leaves nothing to compact at that order
+	fragment(1);
+	buddy_set_relocate(relocate, NULL);
+	EXPECT(buddy_compact(BIG_ORDER, 0) == -1);
+	EXPECT(buddy_compact(BIG_ORDER - 1, 0) == 1);
+	EXPECT(buddy_check() == 0 && tags_intact());
+
+	return test_result();
+}
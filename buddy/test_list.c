@@ -65,7 +65,7 @@ int main(void){
 	}
 
 	// Find and delete 2
-	struct list_head * target;
+	struct list_head * target = NULL;
 	list_for_each(p, &myList){
 		current = list_entry(p, struct list_member, list);
 		if(current->value == 2){
@@ -0,0 +1,85 @@
+/*
+ * Checks the malloc family exported by libbuddymalloc.so.  Run with the
+ * library in LD_PRELOAD; the usable sizes it checks differ from glibc's, so
+ * running it without the library fails.
+ */
+
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_util.h"
+
+#define ALIGNED(p, a) (((uintptr_t)(p) & ((a) - 1)) == 0)
+
+int main(void)
+{
+	void *small[1000];
+	char *p, *q;
+	void *m;
+	volatile size_t n;
+	int i, rc;
+
+	// Size classes round up to powers of two from 16 bytes
+	p = malloc(100);
+	EXPECT(p != NULL && malloc_usable_size(p) == 128 && ALIGNED(p, 16));
+	free(p);
+	p = malloc(1);
+	EXPECT(p != NULL && malloc_usable_size(p) == 16);
+	free(p);
+
+	// Enough small objects to need several pages, all distinct and usable
+	for (i = 0; i < 1000; i++) {
+		small[i] = malloc(48);
+		memset(small[i], i & 0xff, 48);
+	}
+	for (i = 0; i < 1000; i++)
+		EXPECT(((unsigned char *)small[i])[47] == (i & 0xff));
+	for (i = 0; i < 1000; i++)
+		free(small[i]);
+
+	// Larger requests are buddy blocks, aligned to their size
+	p = malloc(5000);
+	EXPECT(p != NULL && malloc_usable_size(p) == 8192 && ALIGNED(p, 8192));
+
+	// Growing within the block keeps it, growing past it moves the data
+	memset(p, 'x', 5000);
+	q = realloc(p, 8000);
+	EXPECT(q == p);
+	q = realloc(q, 20000);
+	EXPECT(q != NULL && q[0] == 'x' && q[4999] == 'x');
+	free(q);
+
+	// Beyond an arena comes from a mapping of its own
+	p = malloc(8 << 20);
+	EXPECT(p != NULL && malloc_usable_size(p) >= (8 << 20));
+	p[(8 << 20) - 1] = 1;
+	free(p);
+
+	p = calloc(1000, 7);
+	for (i = 0; i < 7000; i++)
+		EXPECT(p[i] == 0);
+	free(p);
+	n = SIZE_MAX / 2;
+	EXPECT(calloc(n, 4) == NULL);
+
+	rc = posix_memalign(&m, 65536, 100);
+	EXPECT(rc == 0 && ALIGNED(m, 65536));
+	if (rc == 0)
+		free(m);
+	rc = posix_memalign(&m, 4 << 20, 100);
+	EXPECT(rc == 0 && ALIGNED(m, 4 << 20));
+	if (rc == 0)
+		free(m);
+	EXPECT(posix_memalign(&m, 24, 100) != 0);
+	m = aligned_alloc(256, 256);
+	EXPECT(m != NULL && ALIGNED(m, 256));
+	free(m);
+
+	EXPECT(realloc(malloc(10), 0) == NULL);
+	free(NULL);
+
+	return test_result();
+}
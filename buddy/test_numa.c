@@ -0,0 +1,73 @@
+/*
+ * Exercises the NUMA arenas on a faked two-node topology: local allocation,
+ * fallback to the other node once the local arena is full, failure once
+ * both are, buddy_alloc going through the arenas, and the per-node counters
+ * along the way.
+ */
+
+#define _GNU_SOURCE		// sched_setaffinity
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "buddy.h"
+#include "buddy_numa.h"
+#include "test_util.h"
+
+int main(void)
+{
+	buddy_numa_stats_t st0, st1;
+	cpu_set_t cpus;
+	int here;
+
+	setenv("BUDDY_FAKE_NUMA", "2", 1);
+	EXPECT(buddy_numa_init() == 2);
+	EXPECT(buddy_numa_nodes() == 2);
+
+	// Stay on one CPU, so the local counts below are known
+	CPU_ZERO(&cpus);
+	CPU_SET(sched_getcpu(), &cpus);
+	sched_setaffinity(0, sizeof(cpus), &cpus);
+	here = buddy_numa_current_node();
+
+	// A whole arena from node 0, then node 0 falls back to node 1
+	void *a = buddy_numa_alloc_onnode((size_t)1 << MAX_ORDER, 0);
+	void *b = buddy_numa_alloc_onnode((size_t)1 << MAX_ORDER, 0);
+	void *c = buddy_numa_alloc_onnode((size_t)1 << MAX_ORDER, 0);
+
+	EXPECT(a != NULL && buddy_numa_node_of(a) == 0);
+	EXPECT(b != NULL && buddy_numa_node_of(b) == 1);
+	EXPECT(c == NULL);
+
+	buddy_numa_get_stats(0, &st0);
+	buddy_numa_get_stats(1, &st1);
+	EXPECT(st0.allocs == 1 && st0.remote == 1 && st0.failures == 1);
+	EXPECT(st1.allocs == 1 && st1.remote == 0);
+
+	// Local means served to a thread on the node, not asked for it
+	EXPECT(st0.local == (here == 0) && st1.local == (here == 1));
+
+	// Frees go back to the arena the block came from
+	buddy_numa_free(b);
+	buddy_numa_free(a);
+	buddy_numa_get_stats(0, &st0);
+	buddy_numa_get_stats(1, &st1);
+	EXPECT(st0.frees == 1 && st1.frees == 1);
+
+	// The caller's node serves small blocks first, through buddy_alloc too
+	void *d = buddy_numa_alloc(4096);
+	EXPECT(d != NULL && buddy_numa_node_of(d) == here);
+	buddy_numa_free(d);
+	d = buddy_alloc(4096);
+	EXPECT(d != NULL && buddy_numa_node_of(d) == here);
+	buddy_free(d);
+	buddy_numa_get_stats(here, &st0);
+	EXPECT(st0.frees == 3);
+
+	EXPECT(buddy_numa_node_of(&failures) == -1);
+	EXPECT(buddy_numa_alloc_onnode(4096, 2) == NULL);
+
+	buddy_numa_print_stats(stdout);
+
+	return test_result();
+}
@@ -0,0 +1,85 @@
+/*
+ * Exercises placed allocation: blocks land exactly at the requested
+ * offset or not at all, reserved ranges are never handed out by
+ * buddy_alloc, and a reservation that overlaps a live block claims
+ * nothing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "buddy.h"
+#include "test_util.h"
+
+#define PAGE ((size_t)1 << MIN_ORDER)
+#define N_PAGES (((size_t)1 << MAX_ORDER) / PAGE)
+
+static char *base;
+
+static void *at(size_t offset)
+{
+	return base + offset;
+}
+
+static int whole(void)
+{
+	return buddy_free_count(MAX_ORDER) == 1 && buddy_check() == 0;
+}
+
+int main(void)
+{
+	static char *pages[N_PAGES];
+	int n, i, outside = 1;
+	void *p;
+
+	buddy_init();
+	base = buddy_alloc_at(0, (size_t)1 << MAX_ORDER);
+	EXPECT(base != NULL);
+	buddy_free(base);
+
+	// Exactly where asked, split from the whole heap
+	p = buddy_alloc_at(0x40000, 3000);
+	EXPECT(p == at(0x40000));
+	EXPECT(buddy_free_count(MIN_ORDER) == 1);
+	EXPECT(buddy_alloc_at(0x40000, PAGE) == NULL);
+	EXPECT(buddy_alloc_at(0x40000, 2 * PAGE) == NULL);
+	EXPECT(buddy_alloc_at(0x41000, 2 * PAGE) == NULL);
+	EXPECT(buddy_alloc_at(0x41000, PAGE) == at(0x41000));
+	EXPECT(buddy_check() == 0);
+	buddy_free(at(0x41000));
+	buddy_free(p);
+	EXPECT(whole());
+
+	// Reservations cover whole pages and are skipped by buddy_alloc
+	EXPECT(buddy_reserve(0x1800, 0x3000) == 0);
+	EXPECT(buddy_alloc_at(0x2000, PAGE) == NULL);
+	for (n = 0; (pages[n] = buddy_alloc(PAGE)) != NULL; n++) {
+		if (pages[n] >= (char *)at(0x1000) && pages[n] < (char *)at(0x5000))
+			outside = 0;
+	}
+	EXPECT(n == N_PAGES - 4 && outside);
+	for (i = 0; i < n; i++)
+		buddy_free(pages[i]);
+	buddy_unreserve(0x1800, 0x3000);
+	EXPECT(whole());
+
+	// Overlapping a live block claims nothing
+	p = buddy_alloc_at(0x10000, PAGE);
+	n = buddy_free_count(MIN_ORDER);
+	EXPECT(buddy_reserve(0xe000, 0x4000) == -1);
+	EXPECT(buddy_free_count(MIN_ORDER) == n && buddy_check() == 0);
+	buddy_free(p);
+	EXPECT(whole());
+
+	// Freeing a block twice counts it once
+	p = buddy_alloc_at(0x20000, PAGE);
+	EXPECT(buddy_alloc_at(0x21000, PAGE) == at(0x21000));
+	buddy_free(p);
+	n = buddy_free_count(MIN_ORDER);
+	buddy_free(p);
+	EXPECT(buddy_free_count(MIN_ORDER) == n && buddy_check() == 0);
+	buddy_free(at(0x21000));
+	EXPECT(whole());
+
+	return test_result();
+}
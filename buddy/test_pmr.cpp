@@ -0,0 +1,118 @@
+/*
+ * Containers on the buddy heap: standard containers built on a
+ * BuddyResource or a BuddyStlAllocator hold their contents, small requests
+ * share pages, alignments are honoured, and once the containers and the
+ * resource are gone the heap is whole again.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+#include "buddy_pmr.hpp"
+#include "test_util.h"
+
+static bool aligned(const void *p, std::size_t alignment)
+{
+	return (reinterpret_cast<std::uintptr_t>(p) & (alignment - 1)) == 0;
+}
+
+int main()
+{
+	buddy_init();
+
+	{
+		BuddyResource r;
+
+		// Pieces of one size come out of one page
+		void *a = r.allocate(10, 8);
+		void *b = r.allocate(16, 16);
+		EXPECT(r.pages() == 1);
+		EXPECT(a != b);
+		EXPECT(aligned(a, 16) && aligned(b, 16));
+		r.deallocate(b, 16, 16);
+		EXPECT(r.allocate(12, 4) == b);
+
+		// Each size below half a page has its own pages, larger sizes
+		// are blocks of their own
+		void *c = r.allocate(100, 64);
+		EXPECT(r.pages() == 2 && aligned(c, 64));
+		void *big = r.allocate(3000, 8);
+		EXPECT(r.pages() == 2 && aligned(big, BuddyResource::page_size));
+		EXPECT(r.blocks() == 1);
+		r.deallocate(big, 3000, 8);
+		EXPECT(r.blocks() == 0);
+
+		// A big alignment on a small request is met by the size class
+		void *d = r.allocate(1, 1024);
+		EXPECT(aligned(d, 1024));
+
+		{
+			std::pmr::vector<int> v(&r);
+			std::pmr::map<int, std::pmr::string> m(&r);
+
+			for (int i = 0; i < 5000; i++)
+				v.push_back(i);
+			for (int i = 0; i < 500; i++)
+				m.emplace(i, std::pmr::string(i % 97 + 20, char('a' + i % 26), &r));
+
+			long sum = 0;
+			for (int x : v)
+				sum += x;
+			EXPECT(sum == 5000L * 4999 / 2);
+			EXPECT(m.size() == 500 && m.at(123).size() == 123 % 97 + 20 && m.at(123)[0] == 'a' + 123 % 26);
+			EXPECT(m.begin()->second.get_allocator().resource() == &r);
+		}
+	}
+	EXPECT(buddy_free_count(MAX_ORDER) == 1);
+
+	// Allocator-aware containers without pmr, on the shared resource
+	{
+		std::vector<double, BuddyStlAllocator<double>> v(1000, 1.5);
+		std::map<int, int, std::less<int>, BuddyStlAllocator<std::pair<const int, int>>> m;
+
+		for (int i = 0; i < 1000; i++)
+			m[i] = i * i;
+		EXPECT(v[999] == 1.5 && m[30] == 900);
+		EXPECT(aligned(v.data(), alignof(double)));
+		EXPECT(m.get_allocator() == BuddyStlAllocator<int>());
+
+		BuddyResource other;
+		EXPECT(BuddyStlAllocator<int>(&other) != BuddyStlAllocator<int>());
+	}
+	BuddyResource::shared().release();
+	EXPECT(buddy_free_count(MAX_ORDER) == 1);
+
+	// Releasing the resource frees large blocks too
+	{
+		BuddyResource r;
+
+		void *small = r.allocate(10, 8);
+		void *large = r.allocate(std::size_t(1) << (MAX_ORDER - 1), 8);
+		EXPECT(small != nullptr && large != nullptr);
+		EXPECT(r.pages() == 1 && r.blocks() == 1);
+		r.release();
+		EXPECT(r.pages() == 0 && r.blocks() == 0);
+		EXPECT(buddy_free_count(MAX_ORDER) == 1);
+	}
+
+	// Running out is reported as bad_alloc
+	{
+		BuddyResource r;
+		bool threw = false;
+
+		try {
+			void *p = r.allocate(std::size_t(2) << MAX_ORDER);
+			r.deallocate(p, std::size_t(2) << MAX_ORDER);
+		} catch (const std::bad_alloc &) {
+			threw = true;
+		}
+		EXPECT(threw);
+	}
+
+	return test_result();
+}
@@ -0,0 +1,176 @@
+/*
+ * Exercises shared pools across processes: a block allocated by one process
+ * is read through its offset by another that mapped the pool elsewhere, and
+ * two processes hammering one pool leave it whole again once both are done.
+ * File pools must come back as they were left, even by a process that
+ * exited without closing them, and a pool whose owner died in the middle
+ * of a call is refused from then on.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "buddy_pool.h"
+#include "test_util.h"
+
+#define POOL_ORDER 22
+#define ROUNDS 20000
+#define LIVE 64
+
+/*
+ * Random allocs and frees, each block filled with a tag that is checked
+ * when it is freed.  Returns the number of blocks found overwritten.
+ */
+static int churn(buddy_pool_t *pool, unsigned seed, int tag)
+{
+	unsigned char *live[LIVE] = { 0 };
+	size_t sizes[LIVE] = { 0 };
+	int bad = 0, r, k;
+
+	srand(seed);
+	for (r = 0; r < ROUNDS + LIVE; r++) {
+		k = r < ROUNDS ? rand() % LIVE : r - ROUNDS;
+		if (live[k] != NULL) {
+			bad += live[k][0] != tag || live[k][sizes[k] - 1] != tag;
+			buddy_pool_free(pool, live[k]);
+			live[k] = NULL;
+		} else if (r < ROUNDS) {
+			sizes[k] = 1 + rand() % 40000;
+			live[k] = buddy_pool_alloc(pool, sizes[k]);
+			if (live[k] != NULL)
+				memset(live[k], tag, sizes[k]);
+		}
+	}
+	return bad;
+}
+
+int main(void)
+{
+	char name[64];
+	int pipefd[2], status;
+	uint64_t off;
+	pid_t pid;
+
+	buddy_pool_t *pool = buddy_pool_create(NULL, POOL_ORDER);
+	EXPECT(pool != NULL);
+	if (pool == NULL)
+		return EXIT_FAILURE;
+	EXPECT(buddy_pool_free_count(pool, POOL_ORDER) == 1);
+
+	// The child maps the pool a second time, at its own address
+	EXPECT(pipe(pipefd) == 0);
+	pid = fork();
+	if (pid == 0) {
+		buddy_pool_t *mine = buddy_pool_attach(dup(buddy_pool_fd(pool)));
+		char *msg = buddy_pool_alloc(mine, 100);
+
+		strcpy(msg, "hello from the child");
+		off = buddy_pool_offset(mine, msg);
+		if (write(pipefd[1], &off, sizeof(off)) != sizeof(off))
+			_exit(1);
+		_exit(churn(mine, 1, 0xc1) ? 1 : 0);
+	}
+
+	EXPECT(read(pipefd[0], &off, sizeof(off)) == sizeof(off));
+	EXPECT(strcmp(buddy_pool_ptr(pool, off), "hello from the child") == 0);
+	EXPECT(churn(pool, 2, 0x9a) == 0);
+	EXPECT(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	// Only the message is left, and freeing it makes the pool whole
+	buddy_pool_free(pool, buddy_pool_ptr(pool, off));
+	EXPECT(buddy_pool_free_count(pool, POOL_ORDER) == 1);
+	EXPECT(buddy_pool_alloc(pool, (1 << POOL_ORDER) + 1) == NULL);
+	buddy_pool_close(pool);
+
+	// A child that dies holding the lock mid-call leaves the pool unusable.
+	// Listing free blocks into an unmapped buffer faults with the lock held
+	// and the busy flag set, as a crash inside an allocation would.
+	pool = buddy_pool_create(NULL, POOL_ORDER);
+	EXPECT(pool != NULL);
+	if (pool != NULL) {
+		pid = fork();
+		if (pid == 0) {
+			uint64_t *trap = mmap(NULL, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+			buddy_pool_free_offsets(pool, POOL_ORDER, trap, 1);
+			_exit(0);
+		}
+		EXPECT(waitpid(pid, &status, 0) == pid && !(WIFEXITED(status) && WEXITSTATUS(status) == 0));
+
+		errno = 0;
+		EXPECT(buddy_pool_alloc(pool, 100) == NULL && errno == ENOTRECOVERABLE);
+		EXPECT(buddy_pool_free_count(pool, POOL_ORDER) == -1);
+		EXPECT(buddy_pool_set_root(pool, 0) == -1);
+		buddy_pool_close(pool);
+	}
+
+	// Named pools are found again by name
+	snprintf(name, sizeof(name), "/buddy_test_%d", (int)getpid());
+	pool = buddy_pool_create(name, MIN_ORDER + 2);
+	EXPECT(pool != NULL);
+	if (pool != NULL) {
+		buddy_pool_t *other = buddy_pool_open(name);
+		char *p = buddy_pool_alloc(pool, 10);
+
+		EXPECT(other != NULL);
+		EXPECT(buddy_pool_create(name, MIN_ORDER + 2) == NULL);
+		strcpy(p, "named");
+		EXPECT(strcmp(buddy_pool_ptr(other, buddy_pool_offset(pool, p)), "named") == 0);
+		EXPECT(buddy_pool_free_count(other, MIN_ORDER) == 1);
+		EXPECT(buddy_pool_free_count(other, MIN_ORDER + 1) == 1);
+		buddy_pool_close(other);
+		buddy_pool_close(pool);
+		EXPECT(buddy_pool_unlink(name) == 0);
+	}
+
+	// A file pool outlives the process that made it
+	snprintf(name, sizeof(name), "%s/buddy_test_%d.pool",
+		 getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", (int)getpid());
+	pool = buddy_pool_create_file(name, POOL_ORDER);
+	EXPECT(pool != NULL);
+	if (pool != NULL) {
+		char *p = buddy_pool_alloc(pool, 5000);
+
+		strcpy(p, "persistent");
+		buddy_pool_set_root(pool, buddy_pool_offset(pool, p));
+		EXPECT(buddy_pool_open_file(name) == NULL);
+		buddy_pool_close(pool);
+
+		// The next run finds the data by the root and leaves without closing
+		pid = fork();
+		if (pid == 0) {
+			buddy_pool_t *mine = buddy_pool_open_file(name);
+			char *q;
+
+			if (mine == NULL || strcmp(buddy_pool_ptr(mine, buddy_pool_root(mine)), "persistent"))
+				_exit(1);
+			q = buddy_pool_alloc(mine, 100);
+			strcpy(q, "second run");
+			buddy_pool_set_root(mine, buddy_pool_offset(mine, q));
+			_exit(0);
+		}
+		EXPECT(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+		pool = buddy_pool_open_file(name);
+		EXPECT(pool != NULL);
+		if (pool != NULL) {
+			EXPECT(strcmp(buddy_pool_ptr(pool, buddy_pool_root(pool)), "second run") == 0);
+			EXPECT(buddy_pool_free_count(pool, MIN_ORDER) == 1);
+			EXPECT(buddy_pool_free_count(pool, MIN_ORDER + 1) == 0);
+			buddy_pool_free(pool, buddy_pool_ptr(pool, buddy_pool_root(pool)));
+			buddy_pool_close(pool);
+		}
+
+		// A file that is not a pool is refused
+		EXPECT(truncate(name, 100) == 0);
+		EXPECT(buddy_pool_open_file(name) == NULL);
+		unlink(name);
+	}
+
+	return test_result();
+}
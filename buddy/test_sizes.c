@@ -0,0 +1,65 @@
+/*
+ * Exercises sizes and offsets at the top of the heap, whatever MAX_ORDER
+ * the tree is built with: the largest blocks land where they should, sizes
+ * past 4 GiB are not truncated, and the heap is whole again at the end.
+ * Only a few pages are ever touched, so this is cheap even for heaps of
+ * tens of GiB.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "buddy.h"
+#include "test_util.h"
+
+#define PAGE ((size_t)1 << MIN_ORDER)
+#define ARENA ((size_t)1 << MAX_ORDER)
+
+int main(void)
+{
+	char *base, *a, *b, *p;
+	size_t offs[2];
+
+	buddy_init();
+	base = buddy_alloc(ARENA);
+	EXPECT(base != NULL);
+	buddy_free(base);
+	EXPECT(buddy_alloc(ARENA + 1) == NULL);
+	EXPECT(buddy_alloc(SIZE_MAX) == NULL);
+
+	// The two halves, the second one from a size just over a quarter
+	a = buddy_alloc(ARENA / 2);
+	b = buddy_alloc(ARENA / 4 + 1);
+	EXPECT(a == base && b == base + ARENA / 2);
+	EXPECT(buddy_alloc(PAGE) == NULL);
+	a[0] = 1;
+	b[ARENA / 2 - 1] = 2;
+	EXPECT(buddy_free_offsets(MAX_ORDER - 1, offs, 2) == 0);
+	buddy_free(b);
+	EXPECT(buddy_free_offsets(MAX_ORDER - 1, offs, 2) == 1 && offs[0] == ARENA / 2);
+
+	// The last page, placed and reserved
+	p = buddy_alloc_at(ARENA - PAGE, PAGE);
+	EXPECT(p == base + ARENA - PAGE);
+	p[PAGE - 1] = 3;
+	buddy_free(p);
+	EXPECT(buddy_reserve(ARENA / 2, ARENA / 2) == 0);
+	EXPECT(buddy_alloc(PAGE) == NULL);
+	buddy_unreserve(ARENA / 2, ARENA / 2);
+	buddy_free(a);
+	EXPECT(buddy_free_count(MAX_ORDER) == 1);
+
+	// Just over 4 GiB is an order 33 block, not one page
+	p = buddy_alloc(((size_t)1 << 32) + PAGE);
+	if (MAX_ORDER < 33) {
+		EXPECT(p == NULL);
+	} else {
+		EXPECT(p == base);
+		EXPECT(buddy_free_count(MAX_ORDER) == 0);
+		buddy_free(p);
+	}
+	EXPECT(buddy_free_count(MAX_ORDER) == 1);
+
+	return test_result();
+}
@@ -0,0 +1,32 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+/*
+ * Checks shared by the test programs.  EXPECT reports a failed condition
+ * and carries on, so one run shows every failure; main ends with
+ * return test_result().  Include this once per test program.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int failures = 0;
+
+#define EXPECT(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+// Exit status of the test program, with a count of the failed checks
+static inline int test_result(void)
+{
+	if (failures) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+#endif // TEST_UTIL_H
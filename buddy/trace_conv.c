@@ -0,0 +1,189 @@
+/*
+ * Convert simulator scripts between the text and binary forms.
+ *
+ * The direction is picked from the input: a binary script (see script.h) is
+ * written out as text, anything else is parsed as text and written out as a
+ * binary script.  Text variable names become handles numbered in order of
+ * first use.  Going back to text, the first 52 handles are named A-Z then
+ * a-z like the classroom samples, and later ones h<handle>.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "script.h"
+#include "symtab.h"
+
+/**
+ * @brief Read a whole stream into memory.
+ */
+static char *read_all(FILE *in, size_t *len)
+{
+	size_t cap = 1 << 20;
+	char *buf = malloc(cap);
+	size_t n;
+
+	*len = 0;
+	while (buf != NULL && (n = fread(buf + *len, 1, cap - *len, in)) > 0) {
+		*len += n;
+		if (*len == cap) {
+			char *bigger = realloc(buf, cap * 2);
+			if (bigger == NULL)
+				free(buf);
+			buf = bigger;
+			cap *= 2;
+		}
+	}
+	return buf;
+}
+
+/**
+ * @brief Binary script to text.
+ */
+static int to_text(const char *buf, FILE *out)
+{
+	const script_hdr_t *hdr = (const script_hdr_t *)buf;
+	const script_rec_t *rec = (const script_rec_t *)(hdr + 1);
+	uint64_t i;
+
+	for (i = 0; i < hdr->count; i++, rec++) {
+		switch (rec->op) {
+		case SCRIPT_ALLOC:
+		case SCRIPT_FREE:
+			script_print_cmd(out, rec->op, rec->handle, rec->size);
+			break;
+		default:
+			fprintf(stderr, "ERROR: Record %" PRIu64 " has unknown op %u\n", i, rec->op);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Text script to binary.  The header is written last, so the output
+ * 		must be seekable.
+ */
+static int to_binary(const char *buf, size_t len, FILE *out)
+{
+	const char *p = buf;
+	const char *end = buf + len;
+	script_cmd_t cmd;
+	uint64_t count = 0;
+	long line = 0;
+	symtab_t *names = symtab_create(1024);
+
+	if (names == NULL || script_write_begin(out) != 0)
+		return -1;
+
+	while (p < end) {
+		const char *eol = memchr(p, '\n', end - p);
+		if (eol == NULL)
+			eol = end;
+		++line;
+
+		if (script_parse_line(p, eol, &cmd) != 0) {
+			fprintf(stderr, "ERROR: Line %ld: Failed to parse command\n", line);
+			return -1;
+		}
+
+		if (cmd.op != SCRIPT_NONE) {
+			long id = symtab_intern(names, cmd.name, cmd.name_len);
+			if (id < 0 || id > UINT32_MAX) {
+				fprintf(stderr, "ERROR: Line %ld: Out of handles\n", line);
+				return -1;
+			}
+			if (script_write_rec(out, cmd.op, (uint32_t)id, cmd.size) != 0)
+				return -1;
+			count++;
+		}
+		p = eol + 1;
+	}
+
+	uint32_t handles = (uint32_t)symtab_count(names);
+	symtab_destroy(names);
+
+	if (script_write_end(out, count, handles) != 0) {
+		perror("ERROR: Failed to write header");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Output program manual
+ *
+ * @param prog_name Name of the program passed in as a command line argument.
+ * @param out File stream to write to.
+ */
+static void print_usage(char* prog_name, FILE* out)
+{
+	fprintf(out, "Usage:\n");
+	fprintf(out, "  %s [-i filename] [-o filename]\n", prog_name);
+	fprintf(out, "     -i [optional] - Script to convert, standard input by default.\n");
+	fprintf(out, "     -o            - Output file. Required for text to binary, standard\n");
+	fprintf(out, "                     output by default for binary to text.\n");
+}
+
+int main(int argc, char** argv)
+{
+	FILE *in = stdin;
+	FILE *out = NULL;
+	char *buf;
+	size_t len;
+	int opt;
+	int ret;
+
+	while ((opt = getopt(argc, argv, "i:o:")) != -1) {
+		switch (opt) {
+		case 'i':
+			in = fopen(optarg, "rb");
+			if (in == NULL) {
+				perror("ERROR: Failed to open input file.");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'o':
+			out = fopen(optarg, "wb");
+			if (out == NULL) {
+				perror("ERROR: Failed to open output file.");
+				return EXIT_FAILURE;
+			}
+			break;
+		default:
+			print_usage(argv[0], stderr);
+			return EXIT_FAILURE;
+		}
+	}
+
+	buf = read_all(in, &len);
+	if (buf == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	switch (script_is_binary(buf, len)) {
+	case 1:
+		ret = to_text(buf, out ? out : stdout);
+		break;
+	case 0:
+		if (out == NULL) {
+			fprintf(stderr, "ERROR: Binary output needs a file (-o)\n");
+			return EXIT_FAILURE;
+		}
+		ret = to_binary(buf, len, out);
+		break;
+	default:
+		fprintf(stderr, "ERROR: Unsupported or truncated binary script\n");
+		return EXIT_FAILURE;
+	}
+
+	free(buf);
+	if (out != NULL && fclose(out) != 0)
+		ret = -1;
+
+	return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,173 @@
+/*
+ * Offline decoder for buddy_trace_write dumps.
+ *
+ * Turns the binary records back into the simulator's script syntax, so a
+ * traced run can be replayed with ./buddy -i.  Blocks are named after the
+ * order in which they were handed out; a name is recycled once its block is
+ * freed.
+ */
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buddy_trace.h"
+#include "script.h"
+
+/* Variables are numbered and printed by script_print_name */
+static int *free_names = NULL;	// Released name numbers, reused first
+static int num_free = 0;
+static int free_cap = 0;
+static int next_name = 0;	// Lowest never used name number
+
+/**
+ * @brief Claim a name number, reusing the most recently released one.
+ */
+static int name_get()
+{
+	if (num_free > 0) {
+		return free_names[--num_free];
+	}
+	return next_name++;
+}
+
+/**
+ * @brief Release a name number for reuse.
+ */
+static void name_put(int n)
+{
+	if (num_free == free_cap) {
+		free_cap = free_cap ? free_cap * 2 : 64;
+		free_names = realloc(free_names, free_cap * sizeof(int));
+		if (free_names == NULL) {
+			fprintf(stderr, "ERROR: Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	free_names[num_free++] = n;
+}
+
+/**
+ * Output program manual
+ *
+ * @param prog_name Name of the program passed in as a command line argument.
+ * @param out File stream to write to.
+ */
+static void print_usage(char* prog_name, FILE* out)
+{
+	fprintf(out, "Usage:\n");
+	fprintf(out, "  %s [-r] [-i filename]\n", prog_name);
+	fprintf(out, "     -i [optional] - Trace dump to decode, standard input by default.\n");
+	fprintf(out, "     -r [optional] - List raw records instead of a simulator script.\n");
+}
+
+int main(int argc, char** argv)
+{
+	FILE *in = stdin;
+	int raw = 0;
+	int opt;
+	trace_file_hdr_t hdr;
+	trace_rec_t rec;
+	int *page_name;
+	uint64_t i;
+
+	while ((opt = getopt(argc, argv, "i:r")) != -1) {
+		switch (opt) {
+		case 'i':
+			in = fopen(optarg, "rb");
+			if (in == NULL) {
+				perror("ERROR: Failed to open input file.");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'r':
+			raw = 1;
+			break;
+		default:
+			print_usage(argv[0], stderr);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, in) != 1 ||
+	    memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) != 0) {
+		fprintf(stderr, "ERROR: Not a trace dump\n");
+		return EXIT_FAILURE;
+	}
+	if (hdr.version != TRACE_VERSION) {
+		fprintf(stderr, "ERROR: Unsupported trace version %u\n", hdr.version);
+		return EXIT_FAILURE;
+	}
+	if (hdr.rec_size != sizeof(trace_rec_t)) {
+		fprintf(stderr, "ERROR: Trace records are %u bytes, expected %zu\n",
+			hdr.rec_size, sizeof(trace_rec_t));
+		return EXIT_FAILURE;
+	}
+	if (hdr.max_order < hdr.min_order || hdr.max_order > 40) {
+		fprintf(stderr, "ERROR: Bad orders %u to %u in trace header\n",
+			hdr.min_order, hdr.max_order);
+		return EXIT_FAILURE;
+	}
+	if (hdr.dropped) {
+		fprintf(stderr, "WARNING: %llu records were lost to ring wrap-around\n",
+			(unsigned long long)hdr.dropped);
+	}
+
+	// Variable currently bound to each page, or -1
+	size_t n_pages = (size_t)1 << (hdr.max_order - hdr.min_order);
+	page_name = malloc(n_pages * sizeof(int));
+	if (page_name == NULL) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		return EXIT_FAILURE;
+	}
+	memset(page_name, 0xff, n_pages * sizeof(int));
+
+	for (i = 0; i < hdr.count && fread(&rec, sizeof(rec), 1, in) == 1; i++) {
+		// Requested sizes are reconstructed from the order
+		unsigned long kbytes = (1ul << rec.order) / 1024;
+
+		if (raw) {
+			printf("%llu %u %s %u %lu\n", (unsigned long long)rec.tsc,
+			       rec.thread,
+			       rec.op == TRACE_ALLOC ? "alloc" :
+			       rec.op == TRACE_FREE ? "free" : "fail",
+			       rec.order, (unsigned long)rec.page << hdr.min_order);
+			continue;
+		}
+
+		switch (rec.op) {
+		case TRACE_ALLOC:
+		case TRACE_ALLOC_FAIL: {
+			int n = name_get();
+			script_print_cmd(stdout, SCRIPT_ALLOC, n, (int64_t)kbytes * 1024);
+			if (rec.op == TRACE_ALLOC && rec.page < n_pages) {
+				page_name[rec.page] = n;
+			}
+			else {
+				name_put(n);
+			}
+			break;
+		}
+		case TRACE_FREE:
+			if (rec.page >= n_pages || page_name[rec.page] < 0) {
+				fprintf(stderr, "WARNING: Free of untraced block at page %u\n", rec.page);
+				break;
+			}
+			script_print_cmd(stdout, SCRIPT_FREE, page_name[rec.page], 0);
+			name_put(page_name[rec.page]);
+			page_name[rec.page] = -1;
+			break;
+		default:
+			fprintf(stderr, "WARNING: Unknown record type %u\n", rec.op);
+		}
+	}
+
+	free(page_name);
+	free(free_names);
+	if (in != stdin)
+		fclose(in);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,541 @@
+/*
+ * Synthetic workload generator for the simulator.
+ *
+ * Writes a script (text, or binary with -b) of allocations and frees drawn
+ * from parameterised distributions:
+ *
+ *  - request sizes (-S), in bytes
+ *  - lifetimes (-L), in operations between an alloc and its free
+ *  - a live-heap target (-H) that allocations stop at, counted in buddy
+ *    blocks so a trace can be sized against the 1 MB pool
+ *  - burst phases (-B) that scale the live-heap target up or down
+ *
+ * A block is freed when its lifetime runs out, or early, oldest death first,
+ * whenever the heap is over target.  Whatever is still live after -n
+ * operations is freed at the end unless -D is given.  The same seed always
+ * gives the same trace.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buddy.h"
+#include "script.h"
+
+/**
+ * Shapes a distribution can take
+ */
+typedef enum dist_kind_t {
+	DIST_FIXED,		///< Always a
+	DIST_UNIFORM,		///< Uniform over [a, b]
+	DIST_LOG,		///< Log-uniform over [a, b]
+	DIST_PARETO,		///< Pareto with minimum a and shape c, capped at b
+	DIST_EXP,		///< Exponential with mean a
+	DIST_BIMODAL		///< a, or b with probability c
+} dist_kind_t;
+
+/**
+ * @type dist_t
+ *
+ * @details A distribution parsed from "kind:a[:b[:c]]".
+ */
+typedef struct dist_t {
+	dist_kind_t kind;
+	double a;
+	double b;
+	double c;
+} dist_t;
+
+/**
+ * @type live_t
+ *
+ * @details A live block, kept in a min-heap on its death time.
+ */
+typedef struct live_t {
+	uint64_t death;		///< Operation at which the block is freed
+	uint32_t handle;
+	uint64_t bytes;		///< Buddy block size backing the request
+} live_t;
+
+/**
+ * @type preset_t
+ *
+ * @details Named scenarios, set before the other options are applied.
+ */
+typedef struct preset_t {
+	const char *name;
+	const char *sizes;
+	const char *lifetimes;
+	const char *heap;
+	const char *bursts;
+} preset_t;
+
+static const preset_t presets[] = {
+	// Constant split and merge traffic, with bursts taking the pool as
+	// full as it gets without running out on the default seed
+	{ "stress", "log:1:64K", "exp:200", "384K", "20000:2000:1.5" },
+	// Heavy-tailed sizes with a long-lived minority pinning small blocks
+	// across the pool, so large requests soon find no room
+	{ "frag", "pareto:1K:1.1:256K", "bimodal:50:100000:0.2", "768K", NULL },
+	{ NULL, NULL, NULL, NULL, NULL }
+};
+
+/**************************************************************************
+ * Random numbers
+ **************************************************************************/
+
+static uint64_t rng_state;
+
+/**
+ * @brief xorshift64*, plenty for workload shapes.
+ */
+static inline uint64_t rng_next()
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545F4914F6CDD1Dull;
+}
+
+/**
+ * @brief Uniform double in [0, 1).
+ */
+static inline double rng_unit()
+{
+	return (rng_next() >> 11) * 0x1.0p-53;
+}
+
+/**
+ * @brief Draw from a distribution.
+ */
+static double dist_draw(const dist_t *d)
+{
+	double u = rng_unit();
+
+	switch (d->kind) {
+	case DIST_UNIFORM:
+		return d->a + u * (d->b - d->a + 1);
+	case DIST_LOG:
+		return exp(log(d->a) + u * (log(d->b + 1) - log(d->a)));
+	case DIST_PARETO: {
+		double x = d->a / pow(1.0 - u, 1.0 / d->c);
+		return x < d->b ? x : d->b;
+	}
+	case DIST_EXP:
+		return -d->a * log(1.0 - u);
+	case DIST_BIMODAL:
+		return u < d->c ? d->b : d->a;
+	case DIST_FIXED:
+	default:
+		return d->a;
+	}
+}
+
+/**************************************************************************
+ * Option parsing
+ **************************************************************************/
+
+/**
+ * @brief Parse a number with an optional K, M or G suffix.
+ *
+ * @return 0 on success, -1 if s is not a number
+ */
+static int parse_num(const char *s, char **end, double *out)
+{
+	double v = strtod(s, end);
+
+	if (*end == s)
+		return -1;
+	if (**end == 'K' || **end == 'k') {
+		v *= 1024;
+		++*end;
+	}
+	else if (**end == 'M' || **end == 'm') {
+		v *= 1024 * 1024;
+		++*end;
+	}
+	else if (**end == 'G' || **end == 'g') {
+		v *= 1024.0 * 1024 * 1024;
+		++*end;
+	}
+	*out = v;
+	return 0;
+}
+
+/**
+ * @brief Parse "kind:a[:b[:c]]" into a distribution.
+ *
+ * @return 0 on success, -1 on a malformed or out of range spec
+ */
+static int parse_dist(const char *spec, dist_t *d)
+{
+	static const struct {
+		const char *name;
+		dist_kind_t kind;
+		int args;
+	} kinds[] = {
+		{ "fixed", DIST_FIXED, 1 },
+		{ "uniform", DIST_UNIFORM, 2 },
+		{ "log", DIST_LOG, 2 },
+		{ "pareto", DIST_PARETO, 3 },
+		{ "exp", DIST_EXP, 1 },
+		{ "bimodal", DIST_BIMODAL, 3 },
+	};
+	const char *colon = strchr(spec, ':');
+	double *args[] = { &d->a, &d->b, &d->c };
+	size_t k;
+	int i;
+
+	if (colon == NULL)
+		return -1;
+
+	for (k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+		if (strlen(kinds[k].name) == (size_t)(colon - spec) &&
+		    strncmp(spec, kinds[k].name, colon - spec) == 0)
+			break;
+	}
+	if (k == sizeof(kinds) / sizeof(kinds[0]))
+		return -1;
+
+	d->kind = kinds[k].kind;
+	d->a = d->b = d->c = 0;
+
+	// Pareto is written min:alpha:max but stored as a, c, b
+	if (d->kind == DIST_PARETO) {
+		args[1] = &d->c;
+		args[2] = &d->b;
+	}
+
+	const char *p = colon;
+	for (i = 0; i < kinds[k].args; i++) {
+		char *end;
+		if (*p != ':' || parse_num(p + 1, &end, args[i]) != 0)
+			return -1;
+		p = end;
+	}
+	if (*p != '\0')
+		return -1;
+
+	switch (d->kind) {
+	case DIST_UNIFORM:
+	case DIST_LOG:
+		return d->a > 0 && d->b >= d->a ? 0 : -1;
+	case DIST_PARETO:
+		return d->a > 0 && d->c > 0 && d->b >= d->a ? 0 : -1;
+	case DIST_BIMODAL:
+		return d->a >= 0 && d->b >= 0 && d->c >= 0 && d->c <= 1 ? 0 : -1;
+	default:
+		return d->a >= 0 ? 0 : -1;
+	}
+}
+
+/**************************************************************************
+ * Live block heap
+ **************************************************************************/
+
+static live_t *heap = NULL;
+static size_t heap_len = 0;
+static size_t heap_cap = 0;
+
+static void heap_push(live_t item)
+{
+	size_t i;
+
+	if (heap_len == heap_cap) {
+		heap_cap = heap_cap ? heap_cap * 2 : 1024;
+		heap = realloc(heap, heap_cap * sizeof(live_t));
+		if (heap == NULL) {
+			fprintf(stderr, "ERROR: Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (i = heap_len++; i > 0 && heap[(i - 1) / 2].death > item.death; i = (i - 1) / 2)
+		heap[i] = heap[(i - 1) / 2];
+	heap[i] = item;
+}
+
+static live_t heap_pop()
+{
+	live_t top = heap[0];
+	live_t last = heap[--heap_len];
+	size_t i = 0;
+
+	for (;;) {
+		size_t c = 2 * i + 1;
+		if (c >= heap_len)
+			break;
+		if (c + 1 < heap_len && heap[c + 1].death < heap[c].death)
+			++c;
+		if (last.death <= heap[c].death)
+			break;
+		heap[i] = heap[c];
+		i = c;
+	}
+	heap[i] = last;
+	return top;
+}
+
+/**************************************************************************
+ * Handles
+ **************************************************************************/
+
+/* Released handles are reused first so binary traces stay dense */
+static uint32_t *free_handles = NULL;
+static size_t num_free = 0;
+static size_t free_cap = 0;
+static uint32_t next_handle = 0;
+
+static uint32_t handle_get()
+{
+	if (num_free > 0)
+		return free_handles[--num_free];
+	return next_handle++;
+}
+
+static void handle_put(uint32_t h)
+{
+	if (num_free == free_cap) {
+		free_cap = free_cap ? free_cap * 2 : 1024;
+		free_handles = realloc(free_handles, free_cap * sizeof(uint32_t));
+		if (free_handles == NULL) {
+			fprintf(stderr, "ERROR: Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	free_handles[num_free++] = h;
+}
+
+/**************************************************************************
+ * Output
+ **************************************************************************/
+
+static FILE *out;
+static int binary = 0;
+static uint64_t written = 0;
+
+static void emit(script_op_t op, uint32_t handle, int64_t size)
+{
+	if (binary) {
+		if (script_write_rec(out, op, handle, size) != 0) {
+			perror("ERROR: Failed to write script");
+			exit(EXIT_FAILURE);
+		}
+	}
+	else {
+		script_print_cmd(out, op, handle, size);
+	}
+	written++;
+}
+
+/**
+ * @brief Bytes of the buddy block that would back a request.
+ */
+static uint64_t block_bytes(int64_t size)
+{
+	uint64_t bytes = (uint64_t)1 << MIN_ORDER;
+
+	while ((int64_t)bytes < size && bytes < ((uint64_t)1 << MAX_ORDER))
+		bytes <<= 1;
+	return bytes;
+}
+
+/**
+ * Output program manual
+ *
+ * @param prog_name Name of the program passed in as a command line argument.
+ * @param out File stream to write to.
+ */
+static void print_usage(char* prog_name, FILE* out)
+{
+	fprintf(out, "Usage:\n");
+	fprintf(out, "  %s [-p preset] [-n ops] [-s seed] [-S sizes] [-L lifetimes]\n", prog_name);
+	fprintf(out, "     [-H bytes] [-B period:length:factor] [-D] [-b] [-o filename]\n");
+	fprintf(out, "     -p [optional] - Start from a preset: stress or frag.\n");
+	fprintf(out, "     -n [optional] - Operations before the final drain, 1000000 by default.\n");
+	fprintf(out, "     -s [optional] - Random seed, 1 by default.\n");
+	fprintf(out, "     -S [optional] - Request sizes in bytes, log:1:64K by default.\n");
+	fprintf(out, "     -L [optional] - Lifetimes in operations, exp:100 by default.\n");
+	fprintf(out, "     -H [optional] - Live-heap target in buddy block bytes, 512K by default.\n");
+	fprintf(out, "     -B [optional] - Every period operations, scale the heap target by\n");
+	fprintf(out, "                     factor for length operations.\n");
+	fprintf(out, "     -D [optional] - Leave live blocks allocated at the end.\n");
+	fprintf(out, "     -b [optional] - Write a binary script. Needs -o.\n");
+	fprintf(out, "     -o [optional] - Output file, standard output by default.\n");
+	fprintf(out, "\n");
+	fprintf(out, "  Distributions: fixed:N  uniform:MIN:MAX  log:MIN:MAX\n");
+	fprintf(out, "                 pareto:MIN:ALPHA:MAX  exp:MEAN  bimodal:A:B:P(B)\n");
+	fprintf(out, "  Numbers take a K, M or G suffix.\n");
+}
+
+int main(int argc, char** argv)
+{
+	const char *preset = NULL;
+	const char *size_spec = NULL;
+	const char *life_spec = NULL;
+	const char *heap_spec = NULL;
+	const char *burst_spec = NULL;
+	const char *out_path = NULL;
+	uint64_t ops = 1000000;
+	uint64_t seed = 1;
+	int drain = 1;
+	dist_t sizes;
+	dist_t lifetimes;
+	double heap_target;
+	double burst_period = 0, burst_len = 0, burst_factor = 1;
+	int opt;
+	char *end;
+
+	while ((opt = getopt(argc, argv, "p:n:s:S:L:H:B:Dbo:")) != -1) {
+		switch (opt) {
+		case 'p':
+			preset = optarg;
+			break;
+		case 'n':
+			ops = strtoull(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'S':
+			size_spec = optarg;
+			break;
+		case 'L':
+			life_spec = optarg;
+			break;
+		case 'H':
+			heap_spec = optarg;
+			break;
+		case 'B':
+			burst_spec = optarg;
+			break;
+		case 'D':
+			drain = 0;
+			break;
+		case 'b':
+			binary = 1;
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		default:
+			print_usage(argv[0], stderr);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// A preset fills in what the options left unset, the defaults the rest
+	if (preset != NULL) {
+		const preset_t *p;
+		for (p = presets; p->name != NULL; p++) {
+			if (strcmp(p->name, preset) == 0)
+				break;
+		}
+		if (p->name == NULL) {
+			fprintf(stderr, "ERROR: Unknown preset %s\n", preset);
+			return EXIT_FAILURE;
+		}
+		if (size_spec == NULL)
+			size_spec = p->sizes;
+		if (life_spec == NULL)
+			life_spec = p->lifetimes;
+		if (heap_spec == NULL)
+			heap_spec = p->heap;
+		if (burst_spec == NULL)
+			burst_spec = p->bursts;
+	}
+	if (size_spec == NULL)
+		size_spec = "log:1:64K";
+	if (life_spec == NULL)
+		life_spec = "exp:100";
+	if (heap_spec == NULL)
+		heap_spec = "512K";
+
+	if (parse_dist(size_spec, &sizes) != 0) {
+		fprintf(stderr, "ERROR: Bad size distribution %s\n", size_spec);
+		return EXIT_FAILURE;
+	}
+	if (parse_dist(life_spec, &lifetimes) != 0) {
+		fprintf(stderr, "ERROR: Bad lifetime distribution %s\n", life_spec);
+		return EXIT_FAILURE;
+	}
+	if (parse_num(heap_spec, &end, &heap_target) != 0 || *end != '\0') {
+		fprintf(stderr, "ERROR: Bad heap target %s\n", heap_spec);
+		return EXIT_FAILURE;
+	}
+	if (burst_spec != NULL &&
+	    (sscanf(burst_spec, "%lf:%lf:%lf", &burst_period, &burst_len, &burst_factor) != 3 ||
+	     burst_period < 1 || burst_len < 0)) {
+		fprintf(stderr, "ERROR: Bad burst spec %s\n", burst_spec);
+		return EXIT_FAILURE;
+	}
+	if (binary && out_path == NULL) {
+		fprintf(stderr, "ERROR: Binary output needs a file (-o)\n");
+		return EXIT_FAILURE;
+	}
+
+	out = out_path ? fopen(out_path, binary ? "wb" : "w") : stdout;
+	if (out == NULL) {
+		perror("ERROR: Failed to open output file.");
+		return EXIT_FAILURE;
+	}
+	if (binary && script_write_begin(out) != 0) {
+		perror("ERROR: Failed to write script");
+		return EXIT_FAILURE;
+	}
+
+	// xorshift must not start at zero
+	rng_state = seed * 0x9E3779B97F4A7C15ull + 1;
+
+	double live = 0;
+	uint64_t t;
+
+	for (t = 0; t < ops; t++) {
+		double target = heap_target;
+		if (burst_spec != NULL && fmod(t, burst_period) < burst_len)
+			target *= burst_factor;
+
+		// Due frees first, then frees that bring the heap back under target
+		if (heap_len > 0 && (heap[0].death <= t || live >= target)) {
+			live_t b = heap_pop();
+			emit(SCRIPT_FREE, b.handle, 0);
+			handle_put(b.handle);
+			live -= b.bytes;
+			continue;
+		}
+
+		int64_t size = (int64_t)dist_draw(&sizes);
+		if (size < 1)
+			size = 1;
+
+		live_t b;
+		b.handle = handle_get();
+		b.bytes = block_bytes(size);
+		b.death = t + 1 + (uint64_t)dist_draw(&lifetimes);
+		heap_push(b);
+		emit(SCRIPT_ALLOC, b.handle, size);
+		live += b.bytes;
+	}
+
+	while (drain && heap_len > 0) {
+		live_t b = heap_pop();
+		emit(SCRIPT_FREE, b.handle, 0);
+	}
+
+	if (binary && script_write_end(out, written, next_handle) != 0) {
+		perror("ERROR: Failed to write header");
+		return EXIT_FAILURE;
+	}
+	if (out != stdout && fclose(out) != 0) {
+		perror("ERROR: Failed to write script");
+		return EXIT_FAILURE;
+	}
+
+	free(heap);
+	free(free_handles);
+	return EXIT_SUCCESS;
+}